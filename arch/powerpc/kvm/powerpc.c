@@ -152,6 +152,9 @@ int kvm_dev_ioctl_check_extension(long ext)
 	case KVM_CAP_COALESCED_MMIO:
 		r = KVM_COALESCED_MMIO_PAGE_OFFSET;
 		break;
+	case KVM_CAP_IOEVENTFD:
+		r = 1;
+		break;
 	default:
 		r = 0;
 		break;
@@ -322,6 +325,18 @@ int kvmppc_handle_load(struct kvm_run *run, struct kvm_vcpu *vcpu,
 	return EMULATE_DO_MMIO;
 }
 
+static int kvmppc_mmio_bus_write(struct kvm_vcpu *vcpu, gpa_t addr,
+				 int len, const void *val)
+{
+	int idx, ret;
+
+	idx = srcu_read_lock(&vcpu->kvm->srcu);
+	ret = kvm_io_bus_write(vcpu->kvm, KVM_MMIO_BUS, addr, len, val);
+	srcu_read_unlock(&vcpu->kvm->srcu, idx);
+
+	return ret;
+}
+
 int kvmppc_handle_store(struct kvm_run *run, struct kvm_vcpu *vcpu,
                         u32 val, unsigned int bytes, int is_bigendian)
 {
@@ -354,6 +369,13 @@ int kvmppc_handle_store(struct kvm_run *run, struct kvm_vcpu *vcpu,
 		}
 	}
 
+	/* Coalesced MMIO zones and ioeventfds (e.g. a virtio queue kick
+	 * serviced by vhost) complete here without a userspace exit. */
+	if (!kvmppc_mmio_bus_write(vcpu, run->mmio.phys_addr, bytes, data)) {
+		vcpu->mmio_needed = 0;
+		return EMULATE_DONE;
+	}
+
 	return EMULATE_DO_MMIO;
 }
 
@@ -0,0 +1,688 @@
+/* bpf_jit_comp.c: BPF JIT compiler for 32-bit PowerPC
+ *
+ * Translates a filter that sk_chk_filter() has accepted into native code
+ * once, at attach time.  Anything the translator does not handle leaves
+ * fp->bpf_func NULL, and the filter keeps running in sk_run_filter().
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/moduleloader.h>
+#include <linux/slab.h>
+#include <asm/cacheflush.h>
+#include <asm/ppc-opcode.h>
+#include <linux/netdevice.h>
+#include <linux/filter.h>
+#include <linux/workqueue.h>
+#include "bpf_jit.h"
+
+int bpf_jit_enable __read_mostly;
+
+/*
+ * pkt_type is a bitfield, so its offset in struct sk_buff has to be
+ * found at run time.
+ */
+#ifdef __BIG_ENDIAN_BITFIELD
+#define PKT_TYPE_MAX	(7 << 5)
+#else
+#define PKT_TYPE_MAX	7
+#endif
+
+static int pkt_type_offset(void)
+{
+	struct sk_buff skb_probe = { .pkt_type = ~0, };
+	u8 *ct = (u8 *)&skb_probe;
+	unsigned int off;
+
+	for (off = 0; off < sizeof(struct sk_buff); off++) {
+		if (ct[off] == PKT_TYPE_MAX)
+			return off;
+	}
+	return -1;
+}
+
+static inline void bpf_flush_icache(void *start, void *end)
+{
+	smp_wmb();
+	flush_icache_range((unsigned long)start, (unsigned long)end);
+}
+
+static void bpf_jit_build_prologue(struct sk_filter *fp, u32 *image,
+				   struct codegen_context *ctx)
+{
+	int i;
+	const struct sock_filter *filter = fp->insns;
+
+	if (ctx->seen & (SEEN_MEM | SEEN_DATAREF)) {
+		/*
+		 * Make stackframe first: there is no red zone below r1
+		 * on ppc32, an interrupt would clobber anything saved there.
+		 */
+		PPC_STWU(1, 1, -BPF_PPC_STACKFRAME);
+		if (ctx->seen & SEEN_DATAREF) {
+			/* If we call any helpers (for loads), save LR */
+			PPC_MFLR(0);
+			PPC_STW(0, 1, BPF_PPC_STACKFRAME + 4);
+
+			/* Back up non-volatile regs. */
+			PPC_STW(r_D, 1, BPF_PPC_STACK_GPR(r_D));
+			PPC_STW(r_HL, 1, BPF_PPC_STACK_GPR(r_HL));
+		}
+		if (ctx->seen & SEEN_MEM) {
+			/*
+			 * Conditionally save regs r16-r31 as some of them
+			 * are used for BPF M[] scratch memory.
+			 */
+			for (i = r_M; i < (r_M+16); i++) {
+				if (ctx->seen & (1 << (i-r_M)))
+					PPC_STW(i, 1, BPF_PPC_STACK_GPR(i));
+			}
+		}
+	}
+
+	if (ctx->seen & SEEN_DATAREF) {
+		/*
+		 * If this filter needs to access skb data,
+		 * prepare r_D and r_HL:
+		 *  r_HL = skb->len - skb->data_len
+		 *  r_D	 = skb->data
+		 */
+		PPC_LWZ_OFFS(r_scratch1, r_skb, offsetof(struct sk_buff,
+							 data_len));
+		PPC_LWZ_OFFS(r_HL, r_skb, offsetof(struct sk_buff, len));
+		PPC_SUB(r_HL, r_HL, r_scratch1);
+		PPC_LWZ_OFFS(r_D, r_skb, offsetof(struct sk_buff, data));
+	}
+
+	if (ctx->seen & SEEN_XREG) {
+		/*
+		 * TODO: Could also detect whether first instr. sets X and
+		 * avoid this (as below, with A).
+		 */
+		PPC_LI(r_X, 0);
+	}
+
+	switch (filter[0].code) {
+	case BPF_RET | BPF_K:
+	case BPF_LD | BPF_W | BPF_LEN:
+	case BPF_LD | BPF_W | BPF_ABS:
+	case BPF_LD | BPF_H | BPF_ABS:
+	case BPF_LD | BPF_B | BPF_ABS:
+		/* first instruction sets A register (or is RET 'constant') */
+		break;
+	default:
+		/* make sure we dont leak kernel information to user */
+		PPC_LI(r_A, 0);
+	}
+}
+
+static void bpf_jit_build_epilogue(u32 *image, struct codegen_context *ctx)
+{
+	int i;
+
+	if (ctx->seen & (SEEN_MEM | SEEN_DATAREF)) {
+		if (ctx->seen & SEEN_DATAREF) {
+			PPC_LWZ(0, 1, BPF_PPC_STACKFRAME + 4);
+			PPC_MTLR(0);
+			PPC_LWZ(r_D, 1, BPF_PPC_STACK_GPR(r_D));
+			PPC_LWZ(r_HL, 1, BPF_PPC_STACK_GPR(r_HL));
+		}
+		if (ctx->seen & SEEN_MEM) {
+			/* Restore any saved non-vol registers */
+			for (i = r_M; i < (r_M+16); i++) {
+				if (ctx->seen & (1 << (i-r_M)))
+					PPC_LWZ(i, 1, BPF_PPC_STACK_GPR(i));
+			}
+		}
+		PPC_ADDI(1, 1, BPF_PPC_STACKFRAME);
+	}
+	/* The RETs have left a return value in R3. */
+
+	PPC_BLR();
+}
+
+/* Branch to the first RET #0, or build one, when cr0 says so. */
+#define PPC_BCC_RET0(cond) do {						      \
+		if (ctx->pc_ret0 != -1) {				      \
+			PPC_BCC(cond, addrs[ctx->pc_ret0]);		      \
+		} else {						      \
+			/*						      \
+			 * Exit, returning 0; first pass hits here	      \
+			 * (longer worst-case code size).		      \
+			 */						      \
+			PPC_BCC_SHORT((cond) ^ COND_CMP_TRUE,		      \
+				      (ctx->idx*4)+12);			      \
+			PPC_LI(r_ret, 0);				      \
+			PPC_JMP(exit_addr);				      \
+		} } while (0)
+
+/* Assemble the body code between the prologue & epilogue. */
+static int bpf_jit_build_body(struct sk_filter *fp, u32 *image,
+			      struct codegen_context *ctx,
+			      unsigned int *addrs)
+{
+	const struct sock_filter *filter = fp->insns;
+	int flen = fp->len;
+	u8 *func;
+	unsigned int true_cond;
+	int i, off;
+
+	/* Start of epilogue code */
+	unsigned int exit_addr = addrs[flen];
+
+	for (i = 0; i < flen; i++) {
+		unsigned int K = filter[i].k;
+
+		/*
+		 * addrs[] maps a BPF bytecode address into a real offset from
+		 * the start of the body code.
+		 */
+		addrs[i] = ctx->idx * 4;
+
+		switch (filter[i].code) {
+			/*** ALU ops ***/
+		case BPF_ALU | BPF_ADD | BPF_X: /* A += X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_ADD(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_ADD | BPF_K: /* A += K; */
+			if (!K)
+				break;
+			PPC_ADDI(r_A, r_A, IMM_L(K));
+			if (K >= 32768)
+				PPC_ADDIS(r_A, r_A, IMM_HA(K));
+			break;
+		case BPF_ALU | BPF_SUB | BPF_X: /* A -= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_SUB(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_SUB | BPF_K: /* A -= K */
+			if (!K)
+				break;
+			PPC_ADDI(r_A, r_A, IMM_L(-K));
+			if (K >= 32768)
+				PPC_ADDIS(r_A, r_A, IMM_HA(-K));
+			break;
+		case BPF_ALU | BPF_MUL | BPF_X: /* A *= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_MUL(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_MUL | BPF_K: /* A *= K */
+			if (K < 32768)
+				PPC_MULI(r_A, r_A, K);
+			else {
+				PPC_LI32(r_scratch1, K);
+				PPC_MUL(r_A, r_A, r_scratch1);
+			}
+			break;
+		case BPF_ALU | BPF_DIV | BPF_X: /* A /= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_CMPWI(r_X, 0);
+			PPC_BCC_RET0(COND_EQ);
+			PPC_DIVWU(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_DIV | BPF_K: /* A /= K */
+			/* sk_chk_filter() has rejected K == 0 */
+			PPC_LI32(r_scratch1, K);
+			PPC_DIVWU(r_A, r_A, r_scratch1);
+			break;
+		case BPF_ALU | BPF_AND | BPF_X:
+			ctx->seen |= SEEN_XREG;
+			PPC_AND(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_AND | BPF_K:
+			if (!IMM_H(K))
+				PPC_ANDI(r_A, r_A, K);
+			else {
+				PPC_LI32(r_scratch1, K);
+				PPC_AND(r_A, r_A, r_scratch1);
+			}
+			break;
+		case BPF_ALU | BPF_OR | BPF_X:
+			ctx->seen |= SEEN_XREG;
+			PPC_OR(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_OR | BPF_K:
+			if (IMM_L(K))
+				PPC_ORI(r_A, r_A, IMM_L(K));
+			if (K >= 65536)
+				PPC_ORIS(r_A, r_A, IMM_H(K));
+			break;
+		case BPF_ALU | BPF_LSH | BPF_X: /* A <<= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_SLW(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_LSH | BPF_K:
+			if (K == 0)
+				break;
+			else if (K >= 32)
+				PPC_LI(r_A, 0);
+			else
+				PPC_SLWI(r_A, r_A, K);
+			break;
+		case BPF_ALU | BPF_RSH | BPF_X: /* A >>= X; */
+			ctx->seen |= SEEN_XREG;
+			PPC_SRW(r_A, r_A, r_X);
+			break;
+		case BPF_ALU | BPF_RSH | BPF_K: /* A >>= K; */
+			if (K == 0)
+				break;
+			else if (K >= 32)
+				PPC_LI(r_A, 0);
+			else
+				PPC_SRWI(r_A, r_A, K);
+			break;
+		case BPF_ALU | BPF_NEG:
+			PPC_NEG(r_A, r_A);
+			break;
+		case BPF_RET | BPF_K:
+			PPC_LI32(r_ret, K);
+			if (!K) {
+				if (ctx->pc_ret0 == -1)
+					ctx->pc_ret0 = i;
+			}
+			/*
+			 * If this isn't the very last instruction, branch to
+			 * the epilogue if we've stuff to clean up.  Otherwise,
+			 * if there's nothing to tidy, just return.  If we /are/
+			 * the last instruction, we're about to fall through to
+			 * the epilogue to return.
+			 */
+			if (i != flen - 1) {
+				/*
+				 * Note: 'seen' is properly valid only on pass
+				 * #2.	Both parts of this conditional are the
+				 * same instruction size though, meaning the
+				 * first pass will still correctly determine the
+				 * code size/addresses.
+				 */
+				if (ctx->seen)
+					PPC_JMP(exit_addr);
+				else
+					PPC_BLR();
+			}
+			break;
+		case BPF_RET | BPF_A:
+			PPC_MR(r_ret, r_A);
+			if (i != flen - 1) {
+				if (ctx->seen)
+					PPC_JMP(exit_addr);
+				else
+					PPC_BLR();
+			}
+			break;
+		case BPF_MISC | BPF_TAX: /* X = A */
+			ctx->seen |= SEEN_XREG;
+			PPC_MR(r_X, r_A);
+			break;
+		case BPF_MISC | BPF_TXA: /* A = X */
+			ctx->seen |= SEEN_XREG;
+			PPC_MR(r_A, r_X);
+			break;
+
+			/*** Constant loads/M[] access ***/
+		case BPF_LD | BPF_IMM: /* A = K */
+			PPC_LI32(r_A, K);
+			break;
+		case BPF_LDX | BPF_IMM: /* X = K */
+			ctx->seen |= SEEN_XREG;
+			PPC_LI32(r_X, K);
+			break;
+		case BPF_LD | BPF_MEM: /* A = mem[K] */
+			PPC_MR(r_A, r_M + (K & 0xf));
+			ctx->seen |= SEEN_MEM | (1<<(K & 0xf));
+			break;
+		case BPF_LDX | BPF_MEM: /* X = mem[K] */
+			PPC_MR(r_X, r_M + (K & 0xf));
+			ctx->seen |= SEEN_XREG | SEEN_MEM | (1<<(K & 0xf));
+			break;
+		case BPF_ST: /* mem[K] = A */
+			PPC_MR(r_M + (K & 0xf), r_A);
+			ctx->seen |= SEEN_MEM | (1<<(K & 0xf));
+			break;
+		case BPF_STX: /* mem[K] = X */
+			PPC_MR(r_M + (K & 0xf), r_X);
+			ctx->seen |= SEEN_XREG | SEEN_MEM | (1<<(K & 0xf));
+			break;
+		case BPF_LD | BPF_W | BPF_LEN: /*	A = skb->len; */
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+			PPC_LWZ_OFFS(r_A, r_skb, offsetof(struct sk_buff, len));
+			break;
+		case BPF_LDX | BPF_W | BPF_LEN: /* X = skb->len; */
+			ctx->seen |= SEEN_XREG;
+			PPC_LWZ_OFFS(r_X, r_skb, offsetof(struct sk_buff, len));
+			break;
+
+			/*** Absolute loads from packet header/data ***/
+		case BPF_LD | BPF_W | BPF_ABS:
+			func = sk_load_word;
+			goto common_load;
+		case BPF_LD | BPF_H | BPF_ABS:
+			func = sk_load_half;
+			goto common_load;
+		case BPF_LD | BPF_B | BPF_ABS:
+			func = sk_load_byte;
+		common_load:
+			/*
+			 * Offsets from SKF_AD_OFF up to 0 are the ancillary
+			 * fields, whatever the load size.
+			 */
+			if ((int)K < 0 && (int)K >= SKF_AD_OFF) {
+				switch (K - SKF_AD_OFF) {
+				case SKF_AD_PROTOCOL: /* A = ntohs(skb->protocol) */
+					BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+								  protocol) != 2);
+					/* Big endian: no byteswap needed */
+					PPC_LHZ_OFFS(r_A, r_skb,
+						     offsetof(struct sk_buff,
+							      protocol));
+					break;
+				case SKF_AD_PKTTYPE:
+					off = pkt_type_offset();
+					if (off < 0)
+						return -ENOTSUPP;
+					PPC_LBZ_OFFS(r_A, r_skb, off);
+#ifdef __BIG_ENDIAN_BITFIELD
+					PPC_SRWI(r_A, r_A, 5);
+#else
+					PPC_ANDI(r_A, r_A, PKT_TYPE_MAX);
+#endif
+					break;
+				case SKF_AD_IFINDEX:
+					BUILD_BUG_ON(FIELD_SIZEOF(struct net_device,
+								  ifindex) != 4);
+					PPC_LWZ_OFFS(r_scratch1, r_skb,
+						     offsetof(struct sk_buff,
+							      dev));
+					PPC_CMPWI(r_scratch1, 0);
+					PPC_BCC_RET0(COND_EQ);
+					PPC_LWZ_OFFS(r_A, r_scratch1,
+						     offsetof(struct net_device,
+							      ifindex));
+					break;
+				case SKF_AD_MARK:
+					BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+								  mark) != 4);
+					PPC_LWZ_OFFS(r_A, r_skb,
+						     offsetof(struct sk_buff,
+							      mark));
+					break;
+				case SKF_AD_QUEUE:
+					BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+								  queue_mapping) != 2);
+					PPC_LHZ_OFFS(r_A, r_skb,
+						     offsetof(struct sk_buff,
+							      queue_mapping));
+					break;
+				default:
+					/*
+					 * The netlink attribute walks are left
+					 * to the interpreter.
+					 */
+					return -ENOTSUPP;
+				}
+				break;
+			}
+
+			/* Load from [K]. */
+			ctx->seen |= SEEN_DATAREF;
+			PPC_LI32(r_scratch1, func);
+			PPC_MTLR(r_scratch1);
+			PPC_LI32(r_addr, K);
+			PPC_BLRL();
+			/*
+			 * Helper returns 'lt' condition on error, and an
+			 * appropriate return value in r3
+			 */
+			PPC_BCC(COND_LT, exit_addr);
+			break;
+
+			/*** Indirect loads from packet header/data ***/
+		case BPF_LD | BPF_W | BPF_IND:
+			func = sk_load_word;
+			goto common_load_ind;
+		case BPF_LD | BPF_H | BPF_IND:
+			func = sk_load_half;
+			goto common_load_ind;
+		case BPF_LD | BPF_B | BPF_IND:
+			func = sk_load_byte;
+		common_load_ind:
+			/*
+			 * Load from [X + K].  Negative offsets are tested for
+			 * in the helper functions.
+			 */
+			ctx->seen |= SEEN_DATAREF | SEEN_XREG;
+			PPC_LI32(r_scratch1, func);
+			PPC_MTLR(r_scratch1);
+			PPC_ADDI(r_addr, r_X, IMM_L(K));
+			if (K >= 32768)
+				PPC_ADDIS(r_addr, r_addr, IMM_HA(K));
+			PPC_BLRL();
+			/* If error, cr0.LT set */
+			PPC_BCC(COND_LT, exit_addr);
+			break;
+
+		case BPF_LDX | BPF_B | BPF_MSH:
+			/* X = 4 * (P[K] & 0xf), ancillary offsets fail */
+			if ((int)K < 0 && (int)K >= SKF_AD_OFF) {
+				PPC_LI(r_ret, 0);
+				PPC_JMP(exit_addr);
+				break;
+			}
+			ctx->seen |= SEEN_DATAREF | SEEN_XREG;
+			PPC_LI32(r_scratch1, sk_load_byte_msh);
+			PPC_MTLR(r_scratch1);
+			PPC_LI32(r_addr, K);
+			PPC_BLRL();
+			PPC_BCC(COND_LT, exit_addr);
+			break;
+
+			/*** Jump and branches ***/
+		case BPF_JMP | BPF_JA:
+			if (K != 0)
+				PPC_JMP(addrs[i + 1 + K]);
+			break;
+
+		case BPF_JMP | BPF_JGT | BPF_K:
+		case BPF_JMP | BPF_JGT | BPF_X:
+			true_cond = COND_GT;
+			goto cond_branch;
+		case BPF_JMP | BPF_JGE | BPF_K:
+		case BPF_JMP | BPF_JGE | BPF_X:
+			true_cond = COND_GE;
+			goto cond_branch;
+		case BPF_JMP | BPF_JEQ | BPF_K:
+		case BPF_JMP | BPF_JEQ | BPF_X:
+			true_cond = COND_EQ;
+			goto cond_branch;
+		case BPF_JMP | BPF_JSET | BPF_K:
+		case BPF_JMP | BPF_JSET | BPF_X:
+			true_cond = COND_NE;
+			/* Fall through */
+		cond_branch:
+			/* same targets, can avoid doing the test :) */
+			if (filter[i].jt == filter[i].jf) {
+				if (filter[i].jt > 0)
+					PPC_JMP(addrs[i + 1 + filter[i].jt]);
+				break;
+			}
+
+			switch (filter[i].code) {
+			case BPF_JMP | BPF_JGT | BPF_X:
+			case BPF_JMP | BPF_JGE | BPF_X:
+			case BPF_JMP | BPF_JEQ | BPF_X:
+				ctx->seen |= SEEN_XREG;
+				PPC_CMPLW(r_A, r_X);
+				break;
+			case BPF_JMP | BPF_JSET | BPF_X:
+				ctx->seen |= SEEN_XREG;
+				PPC_AND_DOT(r_scratch1, r_A, r_X);
+				break;
+			case BPF_JMP | BPF_JEQ | BPF_K:
+			case BPF_JMP | BPF_JGT | BPF_K:
+			case BPF_JMP | BPF_JGE | BPF_K:
+				if (K < 32768)
+					PPC_CMPLWI(r_A, K);
+				else {
+					PPC_LI32(r_scratch1, K);
+					PPC_CMPLW(r_A, r_scratch1);
+				}
+				break;
+			case BPF_JMP | BPF_JSET | BPF_K:
+				if (K < 32768)
+					/* PPC_ANDI is /only/ dot-form */
+					PPC_ANDI(r_scratch1, r_A, K);
+				else {
+					PPC_LI32(r_scratch1, K);
+					PPC_AND_DOT(r_scratch1, r_A,
+						    r_scratch1);
+				}
+				break;
+			}
+			/* Sometimes branches are constructed "backward", with
+			 * the false path being the branch and true path being
+			 * a fallthrough to the next instruction.
+			 */
+			if (filter[i].jt == 0)
+				/* Swap the sense of the branch */
+				PPC_BCC(true_cond ^ COND_CMP_TRUE,
+					addrs[i + 1 + filter[i].jf]);
+			else {
+				PPC_BCC(true_cond, addrs[i + 1 + filter[i].jt]);
+				if (filter[i].jf != 0)
+					PPC_JMP(addrs[i + 1 + filter[i].jf]);
+			}
+			break;
+		default:
+			/* The filter contains something cruel & unusual.
+			 * We don't handle it, but also there shouldn't be
+			 * anything missing from our list.
+			 */
+			if (printk_ratelimit())
+				pr_err("BPF filter opcode %04x (@%d) unsupported\n",
+				       filter[i].code, i);
+			return -ENOTSUPP;
+		}
+
+	}
+	/* Set end-of-body-code address for exit. */
+	addrs[i] = ctx->idx * 4;
+
+	return 0;
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	unsigned int proglen;
+	unsigned int alloclen;
+	u32 *image = NULL;
+	unsigned int *addrs;
+	struct codegen_context cgctx;
+	int pass;
+	int flen = fp->len;
+
+	if (!bpf_jit_enable)
+		return;
+
+	addrs = kzalloc((flen+1) * sizeof(*addrs), GFP_KERNEL);
+	if (addrs == NULL)
+		return;
+
+	/*
+	 * There are multiple assembly passes as the generated code will change
+	 * size as it settles down, figuring out the max branch offsets/exit
+	 * paths required.
+	 *
+	 * The range of standard conditional branches is +/- 32Kbytes.	Since
+	 * BPF_MAXINSNS = 4096, we can only jump from (worst case) start to
+	 * finish with 8 bytes/instruction.  Not feasible, so long jumps are
+	 * used, distinct from short branches.
+	 *
+	 * Both branch types assemble to 2 words (short branches padded with a
+	 * NOP); this is less efficient, but assembly will always complete
+	 * after exactly 3 passes:
+	 *
+	 * First pass: No code buffer; Program is "faux-generated" -- no code
+	 * emitted but maximum size of output determined (and addrs[] filled
+	 * in).	 Also, we note whether we use M[], whether we use skb data, etc.
+	 * All generation choices assumed to be 'worst-case', e.g. branches all
+	 * far (2 instructions), return path code reduction not available, etc.
+	 *
+	 * Second pass: Code buffer allocated with size determined previously.
+	 * Prologue generated to support features we have seen used.  Exit paths
+	 * determined and addrs[] is filled in again, as code may be slightly
+	 * smaller as a result.
+	 *
+	 * Third pass: Code generated 'for real', and branch destinations
+	 * determined from now-accurate addrs[] map.
+	 */
+
+	cgctx.idx = 0;
+	cgctx.seen = 0;
+	cgctx.pc_ret0 = -1;
+	/* Scouting faux-generate pass 0 */
+	if (bpf_jit_build_body(fp, 0, &cgctx, addrs))
+		/* We hit something illegal or unsupported. */
+		goto out;
+
+	/*
+	 * Pretend to build prologue, given the features we've seen.  This will
+	 * update ctgtx.idx as it pretends to output instructions, then we can
+	 * calculate total size from idx.
+	 */
+	bpf_jit_build_prologue(fp, 0, &cgctx);
+	bpf_jit_build_epilogue(0, &cgctx);
+
+	proglen = cgctx.idx * 4;
+	/* The image doubles as a work_struct when it is freed */
+	alloclen = max_t(unsigned int, proglen, sizeof(struct work_struct));
+	image = module_alloc(alloclen);
+	if (!image)
+		goto out;
+
+	/* Code generation passes 1-2 */
+	for (pass = 1; pass < 3; pass++) {
+		/* Now build the prologue, body code & epilogue for real. */
+		cgctx.idx = 0;
+		bpf_jit_build_prologue(fp, image, &cgctx);
+		bpf_jit_build_body(fp, image, &cgctx, addrs);
+		bpf_jit_build_epilogue(image, &cgctx);
+
+		if (bpf_jit_enable > 1)
+			pr_info("Pass %d: shrink = %d, seen = 0x%x\n", pass,
+				proglen - (cgctx.idx * 4), cgctx.seen);
+	}
+
+	if (bpf_jit_enable > 1) {
+		pr_info("flen=%d proglen=%u pass=%d image=%p\n",
+			flen, proglen, pass, image);
+		print_hex_dump(KERN_ERR, "JIT code: ", DUMP_PREFIX_ADDRESS,
+			       16, 1, image, proglen, false);
+	}
+
+	bpf_flush_icache(image, image + (proglen/4));
+	fp->bpf_func = (void *)image;
+out:
+	kfree(addrs);
+	return;
+}
+
+static void jit_free_defer(struct work_struct *arg)
+{
+	module_free(NULL, arg);
+}
+
+/* run from softirq, we must use a work_struct to call
+ * module_free() from process context
+ */
+void bpf_jit_free(struct sk_filter *fp)
+{
+	if (fp->bpf_func) {
+		struct work_struct *work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, jit_free_defer);
+		schedule_work(work);
+	}
+}
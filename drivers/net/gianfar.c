@@ -112,6 +112,8 @@ static int gfar_close(struct net_device *dev);
 struct sk_buff *gfar_new_skb(struct net_device *dev);
 static void gfar_new_rxbdp(struct gfar_priv_rx_q *rx_queue, struct rxbd8 *bdp,
 		struct sk_buff *skb);
+static int gfar_rx_alloc_page(struct gfar_private *priv,
+		struct gfar_rx_buff *rxb, gfp_t gfp);
 static int gfar_set_mac_address(struct net_device *dev);
 static int gfar_change_mtu(struct net_device *dev, int new_mtu);
 static irqreturn_t gfar_error(int irq, void *dev_id);
@@ -134,7 +136,7 @@ static void gfar_netpoll(struct net_device *dev);
 int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit);
 static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue);
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull);
+			      int amount_pull, struct napi_struct *napi);
 static void gfar_vlan_rx_register(struct net_device *netdev,
 		                struct vlan_group *grp);
 void gfar_halt(struct net_device *dev);
@@ -202,8 +204,24 @@ static int gfar_init_bds(struct net_device *ndev)
 		rxbdp = rx_queue->rx_bd_base;
 
 		for (j = 0; j < rx_queue->rx_ring_size; j++) {
-			struct sk_buff *skb = rx_queue->rx_skbuff[j];
+			struct sk_buff *skb;
 
+			if (priv->rx_stride) {
+				struct gfar_rx_buff *rxb = &rx_queue->rx_buff[j];
+
+				if (!rxb->page &&
+				    gfar_rx_alloc_page(priv, rxb, GFP_KERNEL)) {
+					pr_err("%s: Can't allocate RX buffers\n",
+							ndev->name);
+					goto err_rxalloc_fail;
+				}
+				gfar_init_rxbdp(rx_queue, rxbdp,
+						rxb->dma + rxb->page_offset);
+				rxbdp++;
+				continue;
+			}
+
+			skb = rx_queue->rx_skbuff[j];
 			if (skb) {
 				gfar_init_rxbdp(rx_queue, rxbdp,
 						rxbdp->bufPtr);
@@ -231,6 +249,20 @@ err_rxalloc_fail:
 	return -ENOMEM;
 }
 
+/*
+ * Frames that fit in half a page or less are received into page chunks
+ * (see gfar_clean_rx_ring_pages()); jumbo frames keep using one skb per BD.
+ */
+static unsigned int gfar_rx_page_stride(struct gfar_private *priv)
+{
+	unsigned int stride = GFAR_RX_MIN_STRIDE;
+
+	while (stride < priv->rx_buffer_size)
+		stride <<= 1;
+
+	return stride <= PAGE_SIZE / 2 ? stride : 0;
+}
+
 static int gfar_alloc_skb_resources(struct net_device *ndev)
 {
 	void *vaddr;
@@ -266,6 +298,7 @@ static int gfar_alloc_skb_resources(struct net_device *ndev)
 		tx_queue->tx_bd_base = (struct txbd8 *) vaddr;
 		tx_queue->tx_bd_dma_base = addr;
 		tx_queue->dev = ndev;
+		tx_queue->tso_hdrs = NULL;
 		/* enet DMA only understands physical addresses */
 		addr    += sizeof(struct txbd8) *tx_queue->tx_ring_size;
 		vaddr   += sizeof(struct txbd8) *tx_queue->tx_ring_size;
@@ -295,10 +328,34 @@ static int gfar_alloc_skb_resources(struct net_device *ndev)
 
 		for (k = 0; k < tx_queue->tx_ring_size; k++)
 			tx_queue->tx_skbuff[k] = NULL;
+
+		tx_queue->tso_hdrs = dma_alloc_coherent(dev,
+				GFAR_TSO_HDR_SIZE * tx_queue->tx_ring_size,
+				&tx_queue->tso_hdrs_dma, GFP_KERNEL);
+		if (!tx_queue->tso_hdrs) {
+			if (netif_msg_ifup(priv))
+				pr_err("%s: Could not allocate TSO headers\n",
+						ndev->name);
+			goto cleanup;
+		}
 	}
 
+	priv->rx_stride = gfar_rx_page_stride(priv);
+
 	for (i = 0; i < priv->num_rx_queues; i++) {
 		rx_queue = priv->rx_queue[i];
+		if (priv->rx_stride) {
+			rx_queue->rx_buff = kcalloc(rx_queue->rx_ring_size,
+					sizeof(*rx_queue->rx_buff), GFP_KERNEL);
+			if (!rx_queue->rx_buff) {
+				if (netif_msg_ifup(priv))
+					pr_err("%s: Could not allocate rx_buff\n",
+					       ndev->name);
+				goto cleanup;
+			}
+			continue;
+		}
+
 		rx_queue->rx_skbuff = kmalloc(sizeof(*rx_queue->rx_skbuff) *
 				  rx_queue->rx_ring_size, GFP_KERNEL);
 
@@ -696,6 +753,7 @@ static int gfar_of_init(struct of_device *ofdev, struct net_device **pdev)
 			goto rx_alloc_failed;
 		}
 		priv->rx_queue[i]->rx_skbuff = NULL;
+		priv->rx_queue[i]->rx_buff = NULL;
 		priv->rx_queue[i]->qindex = i;
 		priv->rx_queue[i]->dev = dev;
 		spin_lock_init(&(priv->rx_queue[i]->rxlock));
@@ -933,7 +991,8 @@ static int gfar_probe(struct of_device *ofdev,
 
 	if (priv->device_flags & FSL_GIANFAR_DEV_HAS_CSUM) {
 		priv->rx_csum_enable = 1;
-		dev->features |= NETIF_F_IP_CSUM | NETIF_F_SG | NETIF_F_HIGHDMA;
+		dev->features |= NETIF_F_IP_CSUM | NETIF_F_SG | NETIF_F_HIGHDMA |
+				 NETIF_F_TSO | NETIF_F_GRO;
 	} else
 		priv->rx_csum_enable = 0;
 
@@ -1576,32 +1635,62 @@ void stop_gfar(struct net_device *dev)
 	free_skb_resources(priv);
 }
 
+static inline struct txbd8 *skip_txbd(struct txbd8 *bdp, int stride,
+			       struct txbd8 *base, int ring_size)
+{
+	struct txbd8 *new_bd = bdp + stride;
+
+	return (new_bd >= (base + ring_size)) ? (new_bd - ring_size) : new_bd;
+}
+
+static inline struct txbd8 *next_txbd(struct txbd8 *bdp, struct txbd8 *base,
+		int ring_size)
+{
+	return skip_txbd(bdp, 1, base, ring_size);
+}
+
+/* Is @addr one of the TSO header slots rather than a mapped skb buffer? */
+static inline int gfar_is_tso_hdr(struct gfar_priv_tx_q *tx_queue,
+				  dma_addr_t addr)
+{
+	return addr >= tx_queue->tso_hdrs_dma &&
+	       addr < tx_queue->tso_hdrs_dma +
+		      GFAR_TSO_HDR_SIZE * tx_queue->tx_ring_size;
+}
+
 static void free_skb_tx_queue(struct gfar_priv_tx_q *tx_queue)
 {
 	struct txbd8 *txbdp;
+	struct txbd8 *base = tx_queue->tx_bd_base;
 	struct gfar_private *priv = netdev_priv(tx_queue->dev);
+	int tx_ring_size = tx_queue->tx_ring_size;
+	struct sk_buff *skb;
 	int i, j;
 
-	txbdp = tx_queue->tx_bd_base;
-
-	for (i = 0; i < tx_queue->tx_ring_size; i++) {
-		if (!tx_queue->tx_skbuff[i])
-			continue;
-
-		dma_unmap_single(&priv->ofdev->dev, txbdp->bufPtr,
-				txbdp->length, DMA_TO_DEVICE);
-		txbdp->lstatus = 0;
-		for (j = 0; j < skb_shinfo(tx_queue->tx_skbuff[i])->nr_frags;
-				j++) {
-			txbdp++;
-			dma_unmap_page(&priv->ofdev->dev, txbdp->bufPtr,
-					txbdp->length, DMA_TO_DEVICE);
+	/* Walk the pending frames the way gfar_clean_tx_ring() does */
+	txbdp = tx_queue->dirty_tx;
+	i = tx_queue->skb_dirtytx;
+
+	while ((skb = tx_queue->tx_skbuff[i])) {
+		for (j = 0; j < GFAR_CB(skb)->nr_txbds; j++) {
+			if (j == 0 && !gfar_is_tso_hdr(tx_queue, txbdp->bufPtr))
+				dma_unmap_single(&priv->ofdev->dev,
+						txbdp->bufPtr, txbdp->length,
+						DMA_TO_DEVICE);
+			else if (j && !gfar_is_tso_hdr(tx_queue, txbdp->bufPtr))
+				dma_unmap_page(&priv->ofdev->dev,
+						txbdp->bufPtr, txbdp->length,
+						DMA_TO_DEVICE);
+			txbdp->lstatus &= BD_LFLAG(TXBD_WRAP);
+			txbdp = next_txbd(txbdp, base, tx_ring_size);
 		}
-		txbdp++;
-		dev_kfree_skb_any(tx_queue->tx_skbuff[i]);
+		dev_kfree_skb_any(skb);
 		tx_queue->tx_skbuff[i] = NULL;
+		i = (i + 1) & TX_RING_MOD_MASK(tx_ring_size);
 	}
 	kfree(tx_queue->tx_skbuff);
+	netdev_tx_reset_queue(netdev_get_tx_queue(tx_queue->dev,
+						  tx_queue->qindex));
 }
 
 static void free_skb_rx_queue(struct gfar_priv_rx_q *rx_queue)
@@ -1627,6 +1716,28 @@ static void free_skb_rx_queue(struct gfar_priv_rx_q *rx_queue)
 	kfree(rx_queue->rx_skbuff);
 }
 
+static void free_rx_pages(struct gfar_priv_rx_q *rx_queue)
+{
+	struct gfar_private *priv = netdev_priv(rx_queue->dev);
+	struct rxbd8 *rxbdp = rx_queue->rx_bd_base;
+	int i;
+
+	for (i = 0; i < rx_queue->rx_ring_size; i++) {
+		struct gfar_rx_buff *rxb = &rx_queue->rx_buff[i];
+
+		if (rxb->page) {
+			dma_unmap_page(&priv->ofdev->dev, rxb->dma,
+				       PAGE_SIZE, DMA_FROM_DEVICE);
+			put_page(rxb->page);
+			rxb->page = NULL;
+		}
+		rxbdp->lstatus = 0;
+		rxbdp->bufPtr = 0;
+		rxbdp++;
+	}
+	kfree(rx_queue->rx_buff);
+}
+
 /* If there are any tx skbs or rx skbs still around, free them.
  * Then free tx_skbuff and rx_skbuff */
 static void free_skb_resources(struct gfar_private *priv)
@@ -1638,14 +1749,25 @@ static void free_skb_resources(struct gfar_private *priv)
 	/* Go through all the buffer descriptors and free their data buffers */
 	for (i = 0; i < priv->num_tx_queues; i++) {
 		tx_queue = priv->tx_queue[i];
-		if(!tx_queue->tx_skbuff)
+		if (tx_queue->tx_skbuff)
 			free_skb_tx_queue(tx_queue);
+		tx_queue->tx_skbuff = NULL;
+		if (tx_queue->tso_hdrs) {
+			dma_free_coherent(&priv->ofdev->dev,
+				GFAR_TSO_HDR_SIZE * tx_queue->tx_ring_size,
+				tx_queue->tso_hdrs, tx_queue->tso_hdrs_dma);
+			tx_queue->tso_hdrs = NULL;
+		}
 	}
 
 	for (i = 0; i < priv->num_rx_queues; i++) {
 		rx_queue = priv->rx_queue[i];
-		if(!rx_queue->rx_skbuff)
+		if (rx_queue->rx_skbuff)
 			free_skb_rx_queue(rx_queue);
+		rx_queue->rx_skbuff = NULL;
+		if (rx_queue->rx_buff)
+			free_rx_pages(rx_queue);
+		rx_queue->rx_buff = NULL;
 	}
 
 	dma_free_coherent(&priv->ofdev->dev,
@@ -1903,18 +2025,176 @@ void inline gfar_tx_vlan(struct sk_buff *skb, struct txfcb *fcb)
 	fcb->vlctl = vlan_tx_tag_get(skb);
 }
 
-static inline struct txbd8 *skip_txbd(struct txbd8 *bdp, int stride,
-			       struct txbd8 *base, int ring_size)
+/*
+ * Software TSO: split a TCPv4 GSO skb into MSS sized frames without
+ * copying the payload.  Each frame starts with a BD pointing at a header
+ * slot that holds the FCB and a fixed up copy of the Ethernet/IP/TCP
+ * headers, followed by BDs pointing straight into the skb's linear area
+ * and page fragments.  The controller fills in the IP and TCP checksums.
+ *
+ * All BDs but the very first are made ready here; the lstatus for the
+ * first one is returned so that the caller can hand the whole chain to
+ * the controller at once.  *last_bdp is set to the final BD used and
+ * *nr_txbds to the number of BDs consumed.
+ */
+static u32 gfar_tso(struct gfar_private *priv,
+		    struct gfar_priv_tx_q *tx_queue, struct sk_buff *skb,
+		    struct txbd8 **last_bdp, unsigned int *nr_txbds)
 {
-	struct txbd8 *new_bd = bdp + stride;
+	struct txbd8 *base = tx_queue->tx_bd_base;
+	struct txbd8 *txbdp = tx_queue->cur_tx;
+	unsigned int hdr_len = skb_transport_offset(skb) + tcp_hdrlen(skb);
+	unsigned int mss = skb_shinfo(skb)->gso_size;
+	unsigned int left = skb->len - hdr_len;
+	unsigned int buf_off = hdr_len;
+	u32 seq = ntohl(tcp_hdr(skb)->seq);
+	u16 ip_id = ntohs(ip_hdr(skb)->id);
+	u32 first_lstatus = 0;
+	unsigned int n = 0;
+	int frag = -1;		/* -1 is the linear area */
+
+	while (left) {
+		unsigned int seg_len = min(left, mss);
+		unsigned int slot;
+		struct txfcb *fcb;
+		struct iphdr *iph;
+		struct tcphdr *th;
+		u8 *hdr;
+		u32 lstatus;
+
+		if (n)
+			txbdp = next_txbd(txbdp, base, tx_queue->tx_ring_size);
+		left -= seg_len;
+
+		/* Build FCB + headers in the slot belonging to this BD */
+		slot = (txbdp - base) * GFAR_TSO_HDR_SIZE;
+		hdr = tx_queue->tso_hdrs + slot;
+		fcb = (struct txfcb *)hdr;
+		memset(fcb, 0, GMAC_FCB_LEN);
+		memcpy(hdr + GMAC_FCB_LEN, skb->data, hdr_len);
+
+		iph = (struct iphdr *)(hdr + GMAC_FCB_LEN +
+				       skb_network_offset(skb));
+		th = (struct tcphdr *)(hdr + GMAC_FCB_LEN +
+				       skb_transport_offset(skb));
+
+		iph->tot_len = htons(hdr_len - skb_network_offset(skb) +
+				     seg_len);
+		iph->id = htons(ip_id++);
+		iph->check = 0;
+
+		th->seq = htonl(seq);
+		seq += seg_len;
+		if (n)
+			th->cwr = 0;
+		if (left)
+			th->fin = th->psh = 0;
+		th->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr,
+					       tcp_hdrlen(skb) + seg_len,
+					       IPPROTO_TCP, 0);
+
+		fcb->flags = TXFCB_DEFAULT | TXFCB_CIP;
+		fcb->phcs = th->check;
+		fcb->l3os = (u16)skb_network_offset(skb);
+		fcb->l4os = skb_network_header_len(skb);
+		if (priv->vlgrp && vlan_tx_tag_present(skb))
+			gfar_tx_vlan(skb, fcb);
+
+		txbdp->bufPtr = tx_queue->tso_hdrs_dma + slot;
+		lstatus = txbdp->lstatus | (GMAC_FCB_LEN + hdr_len) |
+			BD_LFLAG(TXBD_TOE | TXBD_CRC | TXBD_READY);
+		if (n)
+			txbdp->lstatus = lstatus;
+		else
+			first_lstatus = lstatus;
+		n++;
 
-	return (new_bd >= (base + ring_size)) ? (new_bd - ring_size) : new_bd;
+		/* Now the payload, straight out of the skb */
+		while (seg_len) {
+			unsigned int buf_len, size, offset;
+			struct page *page;
+
+			if (frag < 0)
+				buf_len = skb_headlen(skb);
+			else
+				buf_len = skb_shinfo(skb)->frags[frag].size;
+
+			if (buf_off == buf_len) {
+				frag++;
+				buf_off = 0;
+				continue;
+			}
+
+			size = min(seg_len, buf_len - buf_off);
+			if (frag < 0) {
+				page = virt_to_page(skb->data + buf_off);
+				offset = offset_in_page(skb->data + buf_off);
+			} else {
+				page = skb_shinfo(skb)->frags[frag].page;
+				offset = skb_shinfo(skb)->frags[frag].page_offset +
+					buf_off;
+			}
+			buf_off += size;
+			seg_len -= size;
+
+			txbdp = next_txbd(txbdp, base, tx_queue->tx_ring_size);
+			txbdp->bufPtr = dma_map_page(&priv->ofdev->dev, page,
+					offset, size, DMA_TO_DEVICE);
+
+			lstatus = txbdp->lstatus | size | BD_LFLAG(TXBD_READY);
+			if (!seg_len) {
+				lstatus |= BD_LFLAG(TXBD_LAST);
+				if (!left)
+					lstatus |= BD_LFLAG(TXBD_INTERRUPT);
+			}
+			txbdp->lstatus = lstatus;
+			n++;
+		}
+	}
+
+	*last_bdp = txbdp;
+	*nr_txbds = n;
+	return first_lstatus;
 }
 
-static inline struct txbd8 *next_txbd(struct txbd8 *bdp, struct txbd8 *base,
-		int ring_size)
+static unsigned int gfar_tso_max_txbds(struct gfar_priv_tx_q *tx_queue)
 {
-	return skip_txbd(bdp, 1, base, ring_size);
+	return min_t(unsigned int, GFAR_TSO_MAX_TXBDS,
+		     tx_queue->tx_ring_size / 2);
+}
+
+/*
+ * Free BDs needed before the queue may be handed another skb: room for
+ * the largest hardware TSO skb, or for a fully fragmented one. Stopping
+ * and waking on this keeps gfar_start_xmit() from ever returning busy.
+ */
+static unsigned int gfar_txbd_thresh(struct net_device *dev,
+				     struct gfar_priv_tx_q *tx_queue)
+{
+	unsigned int thresh = MAX_SKB_FRAGS + 1;
+
+	if (dev->features & NETIF_F_TSO)
+		thresh = max(thresh, gfar_tso_max_txbds(tx_queue));
+
+	return min(thresh, tx_queue->tx_ring_size);
+}
+
+/*
+ * TSO skbs that would take too many BDs (a tiny MSS) or whose
+ * headers do not fit a header slot are segmented in software instead.
+ * The segments hang off skb->next and the skb goes back to the qdisc,
+ * which hands them to us one by one and requeues on a full ring.
+ */
+static int gfar_tso_fallback(struct sk_buff *skb, struct net_device *dev)
+{
+	if (dev_gso_segment_features(skb, dev->features & ~NETIF_F_TSO) ||
+	    !skb->next) {
+		dev->stats.tx_dropped++;
+		kfree_skb(skb);
+		return NETDEV_TX_OK;
+	}
+
+	return NETDEV_TX_BUSY;
 }
 
 /* This is called by the kernel when a frame is ready for transmission. */
@@ -1931,7 +2211,8 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	int i, rq = 0;
 	u32 bufaddr;
 	unsigned long flags;
-	unsigned int nr_frags, length;
+	unsigned int nr_frags, nr_txbds, length;
+	int more = skb->xmit_more;
 
 
 	rq = skb->queue_mapping;
@@ -1940,6 +2221,36 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	base = tx_queue->tx_bd_base;
 	regs = tx_queue->grp->regs;
 
+	if (skb_is_gso(skb)) {
+		unsigned int hdr_len = skb_transport_offset(skb) +
+				       tcp_hdrlen(skb);
+		unsigned int segs = DIV_ROUND_UP(skb->len - hdr_len,
+						 skb_shinfo(skb)->gso_size);
+
+		/* worst case: every segment splits one buffer in two */
+		nr_txbds = 2 * segs + skb_shinfo(skb)->nr_frags;
+		if (unlikely(nr_txbds > gfar_tso_max_txbds(tx_queue) ||
+			     hdr_len + GMAC_FCB_LEN > GFAR_TSO_HDR_SIZE ||
+			     hdr_len > skb_headlen(skb)))
+			return gfar_tso_fallback(skb, dev);
+
+		/* can only happen if TSO was turned on under a queued skb */
+		if (unlikely(nr_txbds > tx_queue->num_txbdfree)) {
+			netif_tx_stop_queue(txq);
+			gfar_write(&regs->tstat,
+				   TSTAT_CLEAR_THALT >> tx_queue->qindex);
+			return NETDEV_TX_BUSY;
+		}
+
+		txq->tx_bytes += skb->len;
+		txq->tx_packets++;
+		GFAR_CB(skb)->bytes_sent = skb->len;
+
+		txbdp_start = tx_queue->cur_tx;
+		lstatus = gfar_tso(priv, tx_queue, skb, &txbdp, &nr_txbds);
+		goto xmit;
+	}
+
 	/* make space for additional header when fcb is needed */
 	if (((skb->ip_summed == CHECKSUM_PARTIAL) ||
 			(priv->vlgrp && vlan_tx_tag_present(skb))) &&
@@ -1950,6 +2261,9 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 		if (!skb_new) {
 			dev->stats.tx_errors++;
 			kfree_skb(skb);
+			/* kick frames an earlier xmit_more left pending */
+			gfar_write(&regs->tstat,
+				   TSTAT_CLEAR_THALT >> tx_queue->qindex);
 			return NETDEV_TX_OK;
 		}
 		kfree_skb(skb);
@@ -1960,16 +2274,17 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	nr_frags = skb_shinfo(skb)->nr_frags;
 
 	/* check if there is space to queue this packet */
-	if ((nr_frags+1) > tx_queue->num_txbdfree) {
+	if (unlikely((nr_frags+1) > tx_queue->num_txbdfree)) {
 		/* no space, stop the queue */
 		netif_tx_stop_queue(txq);
-		dev->stats.tx_fifo_errors++;
+		gfar_write(&regs->tstat, TSTAT_CLEAR_THALT >> tx_queue->qindex);
 		return NETDEV_TX_BUSY;
 	}
 
 	/* Update transmit stats */
 	txq->tx_bytes += skb->len;
 	txq->tx_packets ++;
+	GFAR_CB(skb)->bytes_sent = skb->len;
 
 	txbdp = txbdp_start = tx_queue->cur_tx;
 
@@ -2025,6 +2340,10 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 			skb_headlen(skb), DMA_TO_DEVICE);
 
 	lstatus |= BD_LFLAG(TXBD_CRC | TXBD_READY) | skb_headlen(skb);
+	nr_txbds = nr_frags + 1;
+
+xmit:
+	GFAR_CB(skb)->nr_txbds = nr_txbds;
 
 	/*
 	 * We can work in parallel with gfar_clean_tx_ring(), except
@@ -2054,6 +2373,8 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 
 	eieio(); /* force lstatus write before tx_skbuff */
 
+	netdev_tx_sent_queue(txq, GFAR_CB(skb)->bytes_sent);
+
 	tx_queue->tx_skbuff[tx_queue->skb_curtx] = skb;
 
 	/* Update the current skb pointer to the next entry we will use
@@ -2064,20 +2385,20 @@ static int gfar_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	tx_queue->cur_tx = next_txbd(txbdp, base, tx_queue->tx_ring_size);
 
 	/* reduce TxBD free count */
-	tx_queue->num_txbdfree -= (nr_frags + 1);
+	tx_queue->num_txbdfree -= nr_txbds;
 
 	dev->trans_start = jiffies;
 
-	/* If the next BD still needs to be cleaned up, then the bds
-	   are full.  We need to tell the kernel to stop sending us stuff. */
-	if (!tx_queue->num_txbdfree) {
+	/* If the next skb might not fit in the free BDs, tell the
+	   kernel to stop sending us stuff. */
+	if (tx_queue->num_txbdfree < gfar_txbd_thresh(dev, tx_queue))
 		netif_tx_stop_queue(txq);
 
-		dev->stats.tx_fifo_errors++;
-	}
-
-	/* Tell the DMA to go go go */
-	gfar_write(&regs->tstat, TSTAT_CLEAR_THALT >> tx_queue->qindex);
+	/* Tell the DMA to go go go, unless the stack is about to queue
+	 * more frames behind this one: the last frame of the batch then
+	 * writes TSTAT for all of them. */
+	if (!more || netif_xmit_stopped(txq))
+		gfar_write(&regs->tstat, TSTAT_CLEAR_THALT >> tx_queue->qindex);
 
 	/* Unlock priv */
 	spin_unlock_irqrestore(&tx_queue->txlock, flags);
@@ -2261,9 +2582,10 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 	struct sk_buff *skb;
 	int skb_dirtytx;
 	int tx_ring_size = tx_queue->tx_ring_size;
-	int frags = 0;
+	int nr_txbds = 0;
 	int i;
 	int howmany = 0;
+	unsigned int bytes_sent = 0;
 	u32 lstatus;
 
 	rx_queue = priv->rx_queue[tx_queue->qindex];
@@ -2273,8 +2595,8 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 	while ((skb = tx_queue->tx_skbuff[skb_dirtytx])) {
 		unsigned long flags;
 
-		frags = skb_shinfo(skb)->nr_frags;
-		lbdp = skip_txbd(bdp, frags, base, tx_ring_size);
+		nr_txbds = GFAR_CB(skb)->nr_txbds;
+		lbdp = skip_txbd(bdp, nr_txbds - 1, base, tx_ring_size);
 
 		lstatus = lbdp->lstatus;
 
@@ -2283,28 +2605,33 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 				(lstatus & BD_LENGTH_MASK))
 			break;
 
-		dma_unmap_single(&priv->ofdev->dev,
-				bdp->bufPtr,
-				bdp->length,
-				DMA_TO_DEVICE);
+		if (!gfar_is_tso_hdr(tx_queue, bdp->bufPtr))
+			dma_unmap_single(&priv->ofdev->dev,
+					bdp->bufPtr,
+					bdp->length,
+					DMA_TO_DEVICE);
 
 		bdp->lstatus &= BD_LFLAG(TXBD_WRAP);
 		bdp = next_txbd(bdp, base, tx_ring_size);
 
-		for (i = 0; i < frags; i++) {
-			dma_unmap_page(&priv->ofdev->dev,
-					bdp->bufPtr,
-					bdp->length,
-					DMA_TO_DEVICE);
+		for (i = 1; i < nr_txbds; i++) {
+			if (!gfar_is_tso_hdr(tx_queue, bdp->bufPtr))
+				dma_unmap_page(&priv->ofdev->dev,
+						bdp->bufPtr,
+						bdp->length,
+						DMA_TO_DEVICE);
 			bdp->lstatus &= BD_LFLAG(TXBD_WRAP);
 			bdp = next_txbd(bdp, base, tx_ring_size);
 		}
 
+		bytes_sent += GFAR_CB(skb)->bytes_sent;
+
 		/*
 		 * If there's room in the queue (limit it to rx_buffer_size)
 		 * we add this skb back into the pool, if it's the right size
 		 */
-		if (skb_queue_len(&priv->rx_recycle) < rx_queue->rx_ring_size &&
+		if (!priv->rx_stride &&
+		    skb_queue_len(&priv->rx_recycle) < rx_queue->rx_ring_size &&
 				skb_recycle_check(skb, priv->rx_buffer_size +
 					RXBUF_ALIGNMENT))
 			__skb_queue_head(&priv->rx_recycle, skb);
@@ -2318,12 +2645,16 @@ static int gfar_clean_tx_ring(struct gfar_priv_tx_q *tx_queue)
 
 		howmany++;
 		spin_lock_irqsave(&tx_queue->txlock, flags);
-		tx_queue->num_txbdfree += frags + 1;
+		tx_queue->num_txbdfree += nr_txbds;
 		spin_unlock_irqrestore(&tx_queue->txlock, flags);
 	}
 
-	/* If we freed a buffer, we can restart transmission, if necessary */
-	if (__netif_subqueue_stopped(dev, tx_queue->qindex) && tx_queue->num_txbdfree)
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, tx_queue->qindex),
+				  howmany, bytes_sent);
+
+	/* If we freed enough buffers, we can restart transmission */
+	if (__netif_subqueue_stopped(dev, tx_queue->qindex) &&
+	    tx_queue->num_txbdfree >= gfar_txbd_thresh(dev, tx_queue))
 		netif_wake_subqueue(dev, tx_queue->qindex);
 
 	/* Update dirty indicators */
@@ -2398,6 +2729,30 @@ struct sk_buff * gfar_new_skb(struct net_device *dev)
 	return skb;
 }
 
+static int gfar_rx_alloc_page(struct gfar_private *priv,
+		struct gfar_rx_buff *rxb, gfp_t gfp)
+{
+	struct page *page;
+	dma_addr_t dma;
+
+	page = alloc_page(gfp);
+	if (unlikely(!page))
+		return -ENOMEM;
+
+	dma = dma_map_page(&priv->ofdev->dev, page, 0, PAGE_SIZE,
+			   DMA_FROM_DEVICE);
+	if (unlikely(dma_mapping_error(&priv->ofdev->dev, dma))) {
+		__free_page(page);
+		return -ENOMEM;
+	}
+
+	rxb->page = page;
+	rxb->dma = dma;
+	rxb->page_offset = 0;
+
+	return 0;
+}
+
 static inline void count_errors(unsigned short status, struct net_device *dev)
 {
 	struct gfar_private *priv = netdev_priv(dev);
@@ -2457,12 +2812,12 @@ static inline void gfar_rx_checksum(struct sk_buff *skb, struct rxfcb *fcb)
 /* gfar_process_frame() -- handle one incoming packet if skb
  * isn't NULL.  */
 static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
-			      int amount_pull)
+			      int amount_pull, struct napi_struct *napi)
 {
 	struct gfar_private *priv = netdev_priv(dev);
 	struct rxfcb *fcb = NULL;
 
-	int ret;
+	gro_result_t ret;
 
 	/* fcb is at the beginning if exists */
 	fcb = (struct rxfcb *)skb->data;
@@ -2482,16 +2837,147 @@ static int gfar_process_frame(struct net_device *dev, struct sk_buff *skb,
 
 	/* Send the packet up the stack */
 	if (unlikely(priv->vlgrp && (fcb->flags & RXFCB_VLN)))
-		ret = vlan_hwaccel_receive_skb(skb, priv->vlgrp, fcb->vlctl);
+		ret = vlan_gro_receive(napi, priv->vlgrp, fcb->vlctl, skb);
 	else
-		ret = netif_receive_skb(skb);
+		ret = napi_gro_receive(napi, skb);
 
-	if (NET_RX_DROP == ret)
+	if (GRO_DROP == ret)
 		priv->extra_stats.kernel_dropped++;
 
 	return 0;
 }
 
+/* gfar_rx_page_skb() -- build an skb around the page chunk the
+ *   controller just filled.  Small frames are copied whole so that the
+ *   chunk can be handed straight back; otherwise only the first
+ *   GFAR_RX_HDR_LEN bytes (FCB, padding and protocol headers) are
+ *   copied and the rest is attached as a page fragment.  The rx slot
+ *   then moves on to the next chunk of the page, wraps around if the
+ *   stack has already released every other chunk, or gets a new page.
+ *   Returns NULL if the frame has to be dropped; the chunk is then
+ *   still owned by the rx slot.
+ */
+static struct sk_buff *gfar_rx_page_skb(struct gfar_priv_rx_q *rx_queue,
+		struct gfar_rx_buff *rxb, unsigned int len)
+{
+	struct net_device *dev = rx_queue->dev;
+	struct gfar_private *priv = netdev_priv(dev);
+	struct device *ddev = &priv->ofdev->dev;
+	unsigned int stride = priv->rx_stride;
+	void *va = page_address(rxb->page) + rxb->page_offset;
+	struct gfar_rx_buff old = *rxb;
+	struct sk_buff *skb;
+	unsigned int hlen;
+
+	dma_sync_single_range_for_cpu(ddev, rxb->dma, rxb->page_offset,
+				      priv->rx_buffer_size, DMA_FROM_DEVICE);
+
+	skb = netdev_alloc_skb(dev, GFAR_RX_COPYBREAK);
+	if (unlikely(!skb))
+		return NULL;
+
+	prefetch(va);
+
+	if (len <= GFAR_RX_COPYBREAK) {
+		memcpy(skb_put(skb, len), va, len);
+		return skb;
+	}
+
+	hlen = GFAR_RX_HDR_LEN;
+	memcpy(skb_put(skb, hlen), va, hlen);
+
+	if (rxb->page_offset + 2 * stride <= PAGE_SIZE) {
+		get_page(rxb->page);
+		rxb->page_offset += stride;
+	} else if (page_count(rxb->page) == 1) {
+		get_page(rxb->page);
+		rxb->page_offset = 0;
+	} else {
+		/* The skb inherits the rx slot's reference to the page */
+		if (unlikely(gfar_rx_alloc_page(priv, rxb, GFP_ATOMIC))) {
+			dev_kfree_skb_any(skb);
+			return NULL;
+		}
+		dma_unmap_page(ddev, old.dma, PAGE_SIZE, DMA_FROM_DEVICE);
+	}
+
+	skb_fill_page_desc(skb, 0, old.page, old.page_offset + hlen,
+			   len - hlen);
+	skb->len += len - hlen;
+	skb->data_len += len - hlen;
+	skb->truesize += stride;
+
+	return skb;
+}
+
+/* gfar_clean_rx_ring_pages() -- page mode counterpart of
+ *   gfar_clean_rx_ring(), used when priv->rx_stride is set
+ */
+static int gfar_clean_rx_ring_pages(struct gfar_priv_rx_q *rx_queue,
+		int rx_work_limit)
+{
+	struct net_device *dev = rx_queue->dev;
+	struct gfar_private *priv = netdev_priv(dev);
+	struct rxbd8 *bdp, *base;
+	struct gfar_rx_buff *rxb;
+	struct sk_buff *skb;
+	int pkt_len;
+	int amount_pull;
+	int howmany = 0;
+
+	/* Get the first full descriptor */
+	bdp = rx_queue->cur_rx;
+	base = rx_queue->rx_bd_base;
+
+	amount_pull = (gfar_uses_fcb(priv) ? GMAC_FCB_LEN : 0) +
+		priv->padding;
+
+	while (!((bdp->status & RXBD_EMPTY) || (--rx_work_limit < 0))) {
+		rmb();
+
+		rxb = &rx_queue->rx_buff[rx_queue->skb_currx];
+
+		if (unlikely(!(bdp->status & RXBD_LAST) ||
+			     bdp->status & RXBD_ERR)) {
+			count_errors(bdp->status, dev);
+		} else {
+			/* Remove the FCS from the packet length */
+			pkt_len = bdp->length - ETH_FCS_LEN;
+
+			skb = gfar_rx_page_skb(rx_queue, rxb, pkt_len);
+			if (likely(skb)) {
+				rx_queue->stats.rx_packets++;
+				rx_queue->stats.rx_bytes += pkt_len;
+				howmany++;
+				skb_record_rx_queue(skb, rx_queue->qindex);
+				gfar_process_frame(dev, skb, amount_pull,
+						&rx_queue->grp->napi);
+			} else {
+				rx_queue->stats.rx_dropped++;
+				priv->extra_stats.rx_skbmissing++;
+			}
+		}
+
+		/* Hand the (possibly new) chunk back to the controller */
+		dma_sync_single_range_for_device(&priv->ofdev->dev, rxb->dma,
+				rxb->page_offset, priv->rx_buffer_size,
+				DMA_FROM_DEVICE);
+		gfar_init_rxbdp(rx_queue, bdp, rxb->dma + rxb->page_offset);
+
+		/* Update to the next pointer */
+		bdp = next_bd(bdp, base, rx_queue->rx_ring_size);
+
+		rx_queue->skb_currx =
+		    (rx_queue->skb_currx + 1) &
+		    RX_RING_MOD_MASK(rx_queue->rx_ring_size);
+	}
+
+	/* Update the current rxbd pointer to be the next one */
+	rx_queue->cur_rx = bdp;
+
+	return howmany;
+}
+
 /* gfar_clean_rx_ring() -- Processes each frame in the rx ring
  *   until the budget/quota has been reached. Returns the number
  *   of frames handled
@@ -2506,6 +2992,9 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 	int howmany = 0;
 	struct gfar_private *priv = netdev_priv(dev);
 
+	if (priv->rx_stride)
+		return gfar_clean_rx_ring_pages(rx_queue, rx_work_limit);
+
 	/* Get the first full descriptor */
 	bdp = rx_queue->cur_rx;
 	base = rx_queue->rx_bd_base;
@@ -2554,7 +3043,8 @@ int gfar_clean_rx_ring(struct gfar_priv_rx_q *rx_queue, int rx_work_limit)
 				skb_put(skb, pkt_len);
 				rx_queue->stats.rx_bytes += pkt_len;
 				skb_record_rx_queue(skb, rx_queue->qindex);
-				gfar_process_frame(dev, skb, amount_pull);
+				gfar_process_frame(dev, skb, amount_pull,
+						&rx_queue->grp->napi);
 
 			} else {
 				if (netif_msg_rx_err(priv))
@@ -53,12 +53,25 @@
 /* Length for FCB */
 #define GMAC_FCB_LEN 8
 
+/* Per-BD slot holding the FCB and headers of an emulated TSO segment */
+#define GFAR_TSO_HDR_SIZE 256
+
+/* Most BDs a TSO skb may take before it is segmented in software */
+#define GFAR_TSO_MAX_TXBDS 128
+
 /* Default padding amount */
 #define DEFAULT_PADDING 2
 
 /* Number of bytes to align the rx bufs to */
 #define RXBUF_ALIGNMENT 64
 
+/* Page based rx: smallest page chunk handed to one rx BD, frames up to
+ * GFAR_RX_COPYBREAK bytes are copied whole, larger ones get their first
+ * GFAR_RX_HDR_LEN bytes copied and the rest attached as a page fragment */
+#define GFAR_RX_MIN_STRIDE	(PAGE_SIZE / 4)
+#define GFAR_RX_COPYBREAK	256
+#define GFAR_RX_HDR_LEN		128
+
 /* The number of bytes which composes a unit for the purpose of
  * allocating data buffers.  ie-for any given MTU, the data buffer
  * will be the next highest multiple of 512 bytes. */
@@ -568,6 +581,8 @@ struct rxfcb {
 
 struct gianfar_skb_cb {
 	int alignamount;
+	unsigned int nr_txbds;	/* tx BDs used by the skb */
+	unsigned int bytes_sent;	/* bytes reported to BQL */
 };
 
 #define GFAR_CB(skb) ((struct gianfar_skb_cb *)((skb)->cb))
@@ -919,6 +934,8 @@ enum {
  *	@dirty_tx: First buffer in line to be transmitted
  *	@tx_ring_size: Tx ring size
  *	@num_txbdfree: number of free TxBds
+ *	@tso_hdrs: FCB + header slots for emulated TSO, one per TxBD
+ *	@tso_hdrs_dma: bus address of @tso_hdrs
  *	@txcoalescing: enable/disable tx coalescing
  *	@txic: transmit interrupt coalescing value
  *	@txcount: coalescing value if based on tx frame count
@@ -939,6 +956,8 @@ struct gfar_priv_tx_q {
 	u16	qindex;
 	unsigned int tx_ring_size;
 	unsigned int num_txbdfree;
+	u8 *tso_hdrs;
+	dma_addr_t tso_hdrs_dma;
 	/* Configuration info for the coalescing features */
 	unsigned char txcoalescing;
 	unsigned long txic;
@@ -959,6 +978,7 @@ struct rx_q_stats {
  *	struct gfar_priv_rx_q - per rx queue structure
  *	@rxlock: per queue rx spin lock
  *	@rx_skbuff: skb pointers
+ *	@rx_buff: page chunks, used instead of @rx_skbuff in page mode
  *	@skb_currx: currently use skb pointer
  *	@rx_bd_base: First rx buffer descriptor
  *	@cur_rx: Next free rx ring entry
@@ -969,9 +989,16 @@ struct rx_q_stats {
  *	@rxic: receive interrupt coalescing vlaue
  */
 
+struct gfar_rx_buff {
+	struct page *page;
+	unsigned int page_offset;
+	dma_addr_t dma;		/* mapping of the whole page */
+};
+
 struct gfar_priv_rx_q {
 	spinlock_t rxlock __attribute__ ((aligned (SMP_CACHE_BYTES)));
 	struct	sk_buff ** rx_skbuff;
+	struct	gfar_rx_buff *rx_buff;
 	dma_addr_t rx_bd_dma_base;
 	struct	rxbd8 *rx_bd_base;
 	struct	rxbd8 *cur_rx;
@@ -1054,6 +1081,8 @@ struct gfar_private {
 
 	/* RX per device parameters */
 	unsigned int rx_buffer_size;
+	/* page chunk per rx BD in page mode, 0 when using skb buffers */
+	unsigned int rx_stride;
 	unsigned int rx_stash_size;
 	unsigned int rx_stash_index;
 
@@ -599,6 +599,25 @@ static uint32_t gfar_get_tx_csum(struct net_device *dev)
 	return (dev->features & NETIF_F_IP_CSUM) != 0;
 }
 
+static int gfar_set_tso(struct net_device *dev, uint32_t data)
+{
+	struct gfar_private *priv = netdev_priv(dev);
+
+	if (!(priv->device_flags & FSL_GIANFAR_DEV_HAS_CSUM))
+		return -EOPNOTSUPP;
+
+	netif_tx_lock_bh(dev);
+
+	if (data)
+		dev->features |= NETIF_F_TSO;
+	else
+		dev->features &= ~NETIF_F_TSO;
+
+	netif_tx_unlock_bh(dev);
+
+	return 0;
+}
+
 static uint32_t gfar_get_msglevel(struct net_device *dev)
 {
 	struct gfar_private *priv = netdev_priv(dev);
@@ -899,6 +918,8 @@ const struct ethtool_ops gfar_ethtool_ops = {
 	.set_rx_csum = gfar_set_rx_csum,
 	.set_tx_csum = gfar_set_tx_csum,
 	.set_sg = ethtool_op_set_sg,
+	.get_tso = ethtool_op_get_tso,
+	.set_tso = gfar_set_tso,
 	.get_msglevel = gfar_get_msglevel,
 	.set_msglevel = gfar_set_msglevel,
 #ifdef CONFIG_PM
@@ -90,24 +90,39 @@ struct tap_filter {
 	unsigned char	addr[FLT_EXACT_COUNT][ETH_ALEN];
 };
 
+/* Upper bound on the number of files attached to an IFF_MULTI_QUEUE
+ * device, one tx queue each. */
+#define MAX_TAP_QUEUES	8
+
+/* A tun_file is the sock behind one open /dev/net/tun descriptor; once
+ * attached it is one queue of the device, with its own receive queue,
+ * wait queue and send buffer accounting. */
 struct tun_file {
-	atomic_t count;
-	struct tun_struct *tun;
-	struct net *net;
+	struct sock		sk;
+	struct socket		socket;
+	atomic_t		count;
+	struct tun_struct	*tun;
+	struct net		*net;
+	struct fasync_struct	*fasync;
+	unsigned int		flags;
+	u16			queue_index;
 };
 
 struct tun_sock;
 
 struct tun_struct {
-	struct tun_file		*tfile;
+	struct tun_file		*tfiles[MAX_TAP_QUEUES];
+	unsigned int		numqueues;
 	unsigned int 		flags;
 	uid_t			owner;
 	gid_t			group;
 
 	struct net_device	*dev;
-	struct fasync_struct	*fasync;
 
 	struct tap_filter       txflt;
+	/* Device wide socket: holds the security label, the socket filter
+	 * and the default sndbuf, and keeps the device around while any
+	 * file still points at it. */
 	struct socket		socket;
 
 #ifdef TUN_DEBUG
@@ -139,13 +154,14 @@ static int tun_attach(struct tun_struct *tun, struct file *file)
 		goto out;
 
 	err = -EBUSY;
-	if (tun->tfile)
+	if (tun->numqueues == tun->dev->num_tx_queues)
 		goto out;
 
 	err = 0;
 	tfile->tun = tun;
-	tun->tfile = tfile;
-	tun->socket.file = file;
+	tfile->queue_index = tun->numqueues;
+	tfile->sk.sk_sndbuf = tun->socket.sk->sk_sndbuf;
+	tun->tfiles[tun->numqueues++] = tfile;
 	dev_hold(tun->dev);
 	sock_hold(tun->socket.sk);
 	atomic_inc(&tfile->count);
@@ -155,25 +171,35 @@ out:
 	return err;
 }
 
-static void __tun_detach(struct tun_struct *tun)
+static void __tun_detach(struct tun_file *tfile)
 {
-	/* Detach from net device */
+	struct tun_struct *tun = tfile->tun;
+	u16 index = tfile->queue_index;
+
+	ASSERT_RTNL();
+
+	/* Detach from net device, the last queue takes over our slot */
 	netif_tx_lock_bh(tun->dev);
-	tun->tfile = NULL;
-	tun->socket.file = NULL;
+	tun->tfiles[index] = tun->tfiles[--tun->numqueues];
+	tun->tfiles[index]->queue_index = index;
+	tun->tfiles[tun->numqueues] = NULL;
 	netif_tx_unlock_bh(tun->dev);
 
 	/* Drop read queue */
-	skb_queue_purge(&tun->socket.sk->sk_receive_queue);
+	skb_queue_purge(&tfile->sk.sk_receive_queue);
+
+	/* Queues may have been renumbered, don't leave one stopped */
+	if (netif_running(tun->dev))
+		netif_tx_wake_all_queues(tun->dev);
 
 	/* Drop the extra count on the net device */
 	dev_put(tun->dev);
 }
 
-static void tun_detach(struct tun_struct *tun)
+static void tun_detach(struct tun_file *tfile)
 {
 	rtnl_lock();
-	__tun_detach(tun);
+	__tun_detach(tfile);
 	rtnl_unlock();
 }
 
@@ -187,17 +213,10 @@ static struct tun_struct *__tun_get(struct tun_file *tfile)
 	return tun;
 }
 
-static struct tun_struct *tun_get(struct file *file)
-{
-	return __tun_get(file->private_data);
-}
-
-static void tun_put(struct tun_struct *tun)
+static void tun_put(struct tun_file *tfile)
 {
-	struct tun_file *tfile = tun->tfile;
-
 	if (atomic_dec_and_test(&tfile->count))
-		tun_detach(tfile->tun);
+		tun_detach(tfile);
 }
 
 /* TAP filterting */
@@ -318,14 +337,18 @@ static const struct ethtool_ops tun_ethtool_ops;
 static void tun_net_uninit(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	struct tun_file *tfile = tun->tfile;
+	int i;
 
 	/* Inform the methods they need to stop using the dev.
+	 * Detaching moves the last queue into the freed slot, so walk
+	 * the queues backwards.
 	 */
-	if (tfile) {
-		wake_up_all(&tun->socket.wait);
+	for (i = tun->numqueues - 1; i >= 0; i--) {
+		struct tun_file *tfile = tun->tfiles[i];
+
+		wake_up_all(&tfile->socket.wait);
 		if (atomic_dec_and_test(&tfile->count))
-			__tun_detach(tun);
+			__tun_detach(tfile);
 	}
 }
 
@@ -339,27 +362,55 @@ static void tun_free_netdev(struct net_device *dev)
 /* Net device open. */
 static int tun_net_open(struct net_device *dev)
 {
-	netif_start_queue(dev);
+	netif_tx_start_all_queues(dev);
 	return 0;
 }
 
 /* Net device close. */
 static int tun_net_close(struct net_device *dev)
 {
-	netif_stop_queue(dev);
+	netif_tx_stop_all_queues(dev);
 	return 0;
 }
 
+/* Spread flows over the attached queues by their hash, so that all the
+ * packets of a flow are read from the same file. */
+static u16 tun_select_queue(struct net_device *dev, struct sk_buff *skb)
+{
+	struct tun_struct *tun = netdev_priv(dev);
+	u32 numqueues = ACCESS_ONCE(tun->numqueues);
+	u32 txq;
+
+	if (numqueues <= 1)
+		return 0;
+
+	txq = skb_get_rxhash(skb);
+	if (txq) {
+		/* use multiply and shift instead of expensive divide */
+		txq = ((u64)txq * numqueues) >> 32;
+	} else if (skb_rx_queue_recorded(skb)) {
+		txq = skb_get_rx_queue(skb);
+		while (unlikely(txq >= numqueues))
+			txq -= numqueues;
+	}
+
+	return txq;
+}
+
 /* Net device start xmit */
 static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
+	u16 txq = skb_get_queue_mapping(skb);
+	struct tun_file *tfile;
 
 	DBG(KERN_INFO "%s: tun_net_xmit %d\n", tun->dev->name, skb->len);
 
-	/* Drop packet if interface is not attached */
-	if (!tun->tfile)
+	/* Drop packet if interface is not attached, or the queue it was
+	 * hashed to went away under us. */
+	if (txq >= tun->numqueues)
 		goto drop;
+	tfile = tun->tfiles[txq];
 
 	/* Drop if the filter does not like it.
 	 * This is a noop if the filter is disabled.
@@ -371,11 +422,12 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	    sk_filter(tun->socket.sk, skb))
 		goto drop;
 
-	if (skb_queue_len(&tun->socket.sk->sk_receive_queue) >= dev->tx_queue_len) {
+	if (skb_queue_len(&tfile->sk.sk_receive_queue) >=
+	    dev->tx_queue_len / tun->numqueues) {
 		if (!(tun->flags & TUN_ONE_QUEUE)) {
 			/* Normal queueing mode. */
 			/* Packet scheduler handles dropping of further packets. */
-			netif_stop_queue(dev);
+			netif_stop_subqueue(dev, txq);
 
 			/* We won't see all dropped packets individually, so overrun
 			 * error is more appropriate. */
@@ -388,13 +440,13 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	/* Enqueue packet */
-	skb_queue_tail(&tun->socket.sk->sk_receive_queue, skb);
+	skb_queue_tail(&tfile->sk.sk_receive_queue, skb);
 	dev->trans_start = jiffies;
 
 	/* Notify and wake up reader process */
-	if (tun->flags & TUN_FASYNC)
-		kill_fasync(&tun->fasync, SIGIO, POLL_IN);
-	wake_up_interruptible_poll(&tun->socket.wait, POLLIN |
+	if (tfile->flags & TUN_FASYNC)
+		kill_fasync(&tfile->fasync, SIGIO, POLL_IN);
+	wake_up_interruptible_poll(&tfile->socket.wait, POLLIN |
 				   POLLRDNORM | POLLRDBAND);
 	return NETDEV_TX_OK;
 
@@ -432,6 +484,7 @@ static const struct net_device_ops tun_netdev_ops = {
 	.ndo_stop		= tun_net_close,
 	.ndo_start_xmit		= tun_net_xmit,
 	.ndo_change_mtu		= tun_net_change_mtu,
+	.ndo_select_queue	= tun_select_queue,
 };
 
 static const struct net_device_ops tap_netdev_ops = {
@@ -440,6 +493,7 @@ static const struct net_device_ops tap_netdev_ops = {
 	.ndo_stop		= tun_net_close,
 	.ndo_start_xmit		= tun_net_xmit,
 	.ndo_change_mtu		= tun_net_change_mtu,
+	.ndo_select_queue	= tun_select_queue,
 	.ndo_set_multicast_list	= tun_net_mclist,
 	.ndo_set_mac_address	= eth_mac_addr,
 	.ndo_validate_addr	= eth_validate_addr,
@@ -490,11 +544,11 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 	if (!tun)
 		return POLLERR;
 
-	sk = tun->socket.sk;
+	sk = &tfile->sk;
 
 	DBG(KERN_INFO "%s: tun_chr_poll\n", tun->dev->name);
 
-	poll_wait(file, &tun->socket.wait, wait);
+	poll_wait(file, &tfile->socket.wait, wait);
 
 	if (!skb_queue_empty(&sk->sk_receive_queue))
 		mask |= POLLIN | POLLRDNORM;
@@ -507,17 +561,17 @@ static unsigned int tun_chr_poll(struct file *file, poll_table * wait)
 	if (tun->dev->reg_state != NETREG_REGISTERED)
 		mask = POLLERR;
 
-	tun_put(tun);
+	tun_put(tfile);
 	return mask;
 }
 
 /* prepad is the amount to reserve at front.  len is length after that.
  * linear is a hint as to how much to copy (usually headers). */
-static inline struct sk_buff *tun_alloc_skb(struct tun_struct *tun,
+static inline struct sk_buff *tun_alloc_skb(struct tun_file *tfile,
 					    size_t prepad, size_t len,
 					    size_t linear, int noblock)
 {
-	struct sock *sk = tun->socket.sk;
+	struct sock *sk = &tfile->sk;
 	struct sk_buff *skb;
 	int err;
 
@@ -540,6 +594,7 @@ static inline struct sk_buff *tun_alloc_skb(struct tun_struct *tun,
 
 /* Get packet from user space buffer */
 static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
+				       struct tun_file *tfile,
 				       const struct iovec *iv, size_t count,
 				       int noblock)
 {
@@ -581,7 +636,7 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
 			return -EINVAL;
 	}
 
-	skb = tun_alloc_skb(tun, align, len, gso.hdr_len, noblock);
+	skb = tun_alloc_skb(tfile, align, len, gso.hdr_len, noblock);
 	if (IS_ERR(skb)) {
 		if (PTR_ERR(skb) != -EAGAIN)
 			tun->dev->stats.rx_dropped++;
@@ -663,6 +718,7 @@ static __inline__ ssize_t tun_get_user(struct tun_struct *tun,
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
+	skb_record_rx_queue(skb, tfile->queue_index);
 	netif_rx_ni(skb);
 
 	tun->dev->stats.rx_packets++;
@@ -675,7 +731,8 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 			      unsigned long count, loff_t pos)
 {
 	struct file *file = iocb->ki_filp;
-	struct tun_struct *tun = tun_get(file);
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = __tun_get(tfile);
 	ssize_t result;
 
 	if (!tun)
@@ -683,10 +740,10 @@ static ssize_t tun_chr_aio_write(struct kiocb *iocb, const struct iovec *iv,
 
 	DBG(KERN_INFO "%s: tun_chr_write %ld\n", tun->dev->name, count);
 
-	result = tun_get_user(tun, iv, iov_length(iv, count),
+	result = tun_get_user(tun, tfile, iv, iov_length(iv, count),
 			      file->f_flags & O_NONBLOCK);
 
-	tun_put(tun);
+	tun_put(tfile);
 	return result;
 }
 
@@ -759,7 +816,7 @@ static __inline__ ssize_t tun_put_user(struct tun_struct *tun,
 	return total;
 }
 
-static ssize_t tun_do_read(struct tun_struct *tun,
+static ssize_t tun_do_read(struct tun_struct *tun, struct tun_file *tfile,
 			   struct kiocb *iocb, const struct iovec *iv,
 			   ssize_t len, int noblock)
 {
@@ -769,12 +826,12 @@ static ssize_t tun_do_read(struct tun_struct *tun,
 
 	DBG(KERN_INFO "%s: tun_chr_read\n", tun->dev->name);
 
-	add_wait_queue(&tun->socket.wait, &wait);
+	add_wait_queue(&tfile->socket.wait, &wait);
 	while (len) {
 		current->state = TASK_INTERRUPTIBLE;
 
 		/* Read frames from the queue */
-		if (!(skb=skb_dequeue(&tun->socket.sk->sk_receive_queue))) {
+		if (!(skb=skb_dequeue(&tfile->sk.sk_receive_queue))) {
 			if (noblock) {
 				ret = -EAGAIN;
 				break;
@@ -792,7 +849,7 @@ static ssize_t tun_do_read(struct tun_struct *tun,
 			schedule();
 			continue;
 		}
-		netif_wake_queue(tun->dev);
+		netif_wake_subqueue(tun->dev, tfile->queue_index);
 
 		ret = tun_put_user(tun, skb, iv, len);
 		kfree_skb(skb);
@@ -800,7 +857,7 @@ static ssize_t tun_do_read(struct tun_struct *tun,
 	}
 
 	current->state = TASK_RUNNING;
-	remove_wait_queue(&tun->socket.wait, &wait);
+	remove_wait_queue(&tfile->socket.wait, &wait);
 
 	return ret;
 }
@@ -821,10 +878,11 @@ static ssize_t tun_chr_aio_read(struct kiocb *iocb, const struct iovec *iv,
 		goto out;
 	}
 
-	ret = tun_do_read(tun, iocb, iv, len, file->f_flags & O_NONBLOCK);
+	ret = tun_do_read(tun, tfile, iocb, iv, len,
+			  file->f_flags & O_NONBLOCK);
 	ret = min_t(ssize_t, ret, len);
 out:
-	tun_put(tun);
+	tun_put(tfile);
 	return ret;
 }
 
@@ -856,7 +914,7 @@ static struct rtnl_link_ops tun_link_ops __read_mostly = {
 
 static void tun_sock_write_space(struct sock *sk)
 {
-	struct tun_struct *tun;
+	struct tun_file *tfile;
 
 	if (!sock_writeable(sk))
 		return;
@@ -868,8 +926,8 @@ static void tun_sock_write_space(struct sock *sk)
 		wake_up_interruptible_sync_poll(sk->sk_sleep, POLLOUT |
 						POLLWRNORM | POLLWRBAND);
 
-	tun = tun_sk(sk)->tun;
-	kill_fasync(&tun->fasync, SIGIO, POLL_OUT);
+	tfile = container_of(sk, struct tun_file, sk);
+	kill_fasync(&tfile->fasync, SIGIO, POLL_OUT);
 }
 
 static void tun_sock_destruct(struct sock *sk)
@@ -880,25 +938,37 @@ static void tun_sock_destruct(struct sock *sk)
 static int tun_sendmsg(struct kiocb *iocb, struct socket *sock,
 		       struct msghdr *m, size_t total_len)
 {
-	struct tun_struct *tun = container_of(sock, struct tun_struct, socket);
-	return tun_get_user(tun, m->msg_iov, total_len,
-			    m->msg_flags & MSG_DONTWAIT);
+	struct tun_file *tfile = container_of(sock, struct tun_file, socket);
+	struct tun_struct *tun = __tun_get(tfile);
+	int ret;
+
+	if (!tun)
+		return -EBADFD;
+	ret = tun_get_user(tun, tfile, m->msg_iov, total_len,
+			   m->msg_flags & MSG_DONTWAIT);
+	tun_put(tfile);
+	return ret;
 }
 
 static int tun_recvmsg(struct kiocb *iocb, struct socket *sock,
 		       struct msghdr *m, size_t total_len,
 		       int flags)
 {
-	struct tun_struct *tun = container_of(sock, struct tun_struct, socket);
+	struct tun_file *tfile = container_of(sock, struct tun_file, socket);
+	struct tun_struct *tun;
 	int ret;
 	if (flags & ~(MSG_DONTWAIT|MSG_TRUNC))
 		return -EINVAL;
-	ret = tun_do_read(tun, iocb, m->msg_iov, total_len,
+	tun = __tun_get(tfile);
+	if (!tun)
+		return -EBADFD;
+	ret = tun_do_read(tun, tfile, iocb, m->msg_iov, total_len,
 			  flags & MSG_DONTWAIT);
 	if (ret > total_len) {
 		m->msg_flags |= MSG_TRUNC;
 		ret = flags & MSG_TRUNC ? ret : total_len;
 	}
+	tun_put(tfile);
 	return ret;
 }
 
@@ -914,6 +984,12 @@ static struct proto tun_proto = {
 	.obj_size	= sizeof(struct tun_sock),
 };
 
+static struct proto tun_file_proto = {
+	.name		= "tun_file",
+	.owner		= THIS_MODULE,
+	.obj_size	= sizeof(struct tun_file),
+};
+
 static int tun_flags(struct tun_struct *tun)
 {
 	int flags = 0;
@@ -932,6 +1008,9 @@ static int tun_flags(struct tun_struct *tun)
 	if (tun->flags & TUN_VNET_HDR)
 		flags |= IFF_VNET_HDR;
 
+	if (tun->flags & TUN_TAP_MQ)
+		flags |= IFF_MULTI_QUEUE;
+
 	return flags;
 }
 
@@ -980,6 +1059,10 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		else
 			return -EINVAL;
 
+		if (!!(ifr->ifr_flags & IFF_MULTI_QUEUE) !=
+		    !!(tun->flags & TUN_TAP_MQ))
+			return -EINVAL;
+
 		if (((tun->owner != -1 && cred->euid != tun->owner) ||
 		     (tun->group != -1 && !in_egroup_p(tun->group))) &&
 		    !capable(CAP_NET_ADMIN))
@@ -995,6 +1078,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	else {
 		char *name;
 		unsigned long flags = 0;
+		unsigned int queues = 1;
 
 		if (!capable(CAP_NET_ADMIN))
 			return -EPERM;
@@ -1017,8 +1101,13 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		if (*ifr->ifr_name)
 			name = ifr->ifr_name;
 
-		dev = alloc_netdev(sizeof(struct tun_struct), name,
-				   tun_setup);
+		if (ifr->ifr_flags & IFF_MULTI_QUEUE) {
+			flags |= TUN_TAP_MQ;
+			queues = MAX_TAP_QUEUES;
+		}
+
+		dev = alloc_netdev_mq(sizeof(struct tun_struct), name,
+				      tun_setup, queues);
 		if (!dev)
 			return -ENOMEM;
 
@@ -1036,9 +1125,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 			goto err_free_dev;
 
 		init_waitqueue_head(&tun->socket.wait);
-		tun->socket.ops = &tun_socket_ops;
 		sock_init_data(&tun->socket, sk);
-		sk->sk_write_space = tun_sock_write_space;
 		sk->sk_sndbuf = INT_MAX;
 
 		tun_sk(sk)->tun = tun;
@@ -1090,7 +1177,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 	 * xoff state.
 	 */
 	if (netif_running(tun->dev))
-		netif_wake_queue(tun->dev);
+		netif_tx_wake_all_queues(tun->dev);
 
 	strcpy(ifr->ifr_name, tun->dev->name);
 	return 0;
@@ -1170,7 +1257,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 	struct sock_fprog fprog;
 	struct ifreq ifr;
 	int sndbuf;
-	int ret;
+	int ret, i;
 
 	if (cmd == TUNSETIFF || _IOC_TYPE(cmd) == 0x89)
 		if (copy_from_user(&ifr, argp, ifreq_len))
@@ -1181,7 +1268,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		 * This is needed because we never checked for invalid flags on
 		 * TUNSETIFF. */
 		return put_user(IFF_TUN | IFF_TAP | IFF_NO_PI | IFF_ONE_QUEUE |
-				IFF_VNET_HDR,
+				IFF_VNET_HDR | IFF_MULTI_QUEUE,
 				(unsigned int __user*)argp);
 	}
 
@@ -1313,6 +1400,8 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 		}
 
 		tun->socket.sk->sk_sndbuf = sndbuf;
+		for (i = 0; i < tun->numqueues; i++)
+			tun->tfiles[i]->sk.sk_sndbuf = sndbuf;
 		break;
 
 	case TUNATTACHFILTER:
@@ -1343,7 +1432,7 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 unlock:
 	rtnl_unlock();
 	if (tun)
-		tun_put(tun);
+		tun_put(tfile);
 	return ret;
 }
 
@@ -1384,7 +1473,8 @@ static long tun_chr_compat_ioctl(struct file *file,
 
 static int tun_chr_fasync(int fd, struct file *file, int on)
 {
-	struct tun_struct *tun = tun_get(file);
+	struct tun_file *tfile = file->private_data;
+	struct tun_struct *tun = __tun_get(tfile);
 	int ret;
 
 	if (!tun)
@@ -1392,34 +1482,46 @@ static int tun_chr_fasync(int fd, struct file *file, int on)
 
 	DBG(KERN_INFO "%s: tun_chr_fasync %d\n", tun->dev->name, on);
 
-	if ((ret = fasync_helper(fd, file, on, &tun->fasync)) < 0)
+	if ((ret = fasync_helper(fd, file, on, &tfile->fasync)) < 0)
 		goto out;
 
 	if (on) {
 		ret = __f_setown(file, task_pid(current), PIDTYPE_PID, 0);
 		if (ret)
 			goto out;
-		tun->flags |= TUN_FASYNC;
+		tfile->flags |= TUN_FASYNC;
 	} else
-		tun->flags &= ~TUN_FASYNC;
+		tfile->flags &= ~TUN_FASYNC;
 	ret = 0;
 out:
-	tun_put(tun);
+	tun_put(tfile);
 	return ret;
 }
 
 static int tun_chr_open(struct inode *inode, struct file * file)
 {
+	struct net *net = current->nsproxy->net_ns;
 	struct tun_file *tfile;
 
 	DBG1(KERN_INFO "tunX: tun_chr_open\n");
 
-	tfile = kmalloc(sizeof(*tfile), GFP_KERNEL);
+	tfile = (struct tun_file *)sk_alloc(net, AF_UNSPEC, GFP_KERNEL,
+					    &tun_file_proto);
 	if (!tfile)
 		return -ENOMEM;
 	atomic_set(&tfile->count, 0);
 	tfile->tun = NULL;
-	tfile->net = get_net(current->nsproxy->net_ns);
+	tfile->net = get_net(net);
+	tfile->fasync = NULL;
+	tfile->flags = 0;
+
+	init_waitqueue_head(&tfile->socket.wait);
+	tfile->socket.file = file;
+	tfile->socket.ops = &tun_socket_ops;
+	sock_init_data(&tfile->socket, &tfile->sk);
+	tfile->sk.sk_write_space = tun_sock_write_space;
+	tfile->sk.sk_sndbuf = INT_MAX;
+
 	file->private_data = tfile;
 	return 0;
 }
@@ -1435,15 +1537,15 @@ static int tun_chr_close(struct inode *inode, struct file *file)
 
 		DBG(KERN_INFO "%s: tun_chr_close\n", dev->name);
 
-		__tun_detach(tun);
+		rtnl_lock();
+		__tun_detach(tfile);
 
-		/* If desirable, unregister the netdevice. */
-		if (!(tun->flags & TUN_PERSIST)) {
-			rtnl_lock();
-			if (dev->reg_state == NETREG_REGISTERED)
-				unregister_netdevice(dev);
-			rtnl_unlock();
-		}
+		/* If desirable, unregister the netdevice once the last
+		 * queue is gone. */
+		if (!(tun->flags & TUN_PERSIST) && !tun->numqueues &&
+		    dev->reg_state == NETREG_REGISTERED)
+			unregister_netdevice(dev);
+		rtnl_unlock();
 	}
 
 	tun = tfile->tun;
@@ -1451,7 +1553,7 @@ static int tun_chr_close(struct inode *inode, struct file *file)
 		sock_put(tun->socket.sk);
 
 	put_net(tfile->net);
-	kfree(tfile);
+	sock_put(&tfile->sk);
 
 	return 0;
 }
@@ -1536,7 +1638,7 @@ static void tun_set_msglevel(struct net_device *dev, u32 value)
 static u32 tun_get_link(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
-	return !!tun->tfile;
+	return !!tun->numqueues;
 }
 
 static u32 tun_get_rx_csum(struct net_device *dev)
@@ -1599,18 +1701,21 @@ static void tun_cleanup(void)
 
 /* Get an underlying socket object from tun file.  Returns error unless file is
  * attached to a device.  The returned object works like a packet socket, it
- * can be used for sock_sendmsg/sock_recvmsg.  The caller is responsible for
- * holding a reference to the file for as long as the socket is in use. */
+ * can be used for sock_sendmsg/sock_recvmsg, and only sees the packets of
+ * this file's queue.  The caller is responsible for holding a reference to
+ * the file for as long as the socket is in use. */
 struct socket *tun_get_socket(struct file *file)
 {
+	struct tun_file *tfile;
 	struct tun_struct *tun;
 	if (file->f_op != &tun_fops)
 		return ERR_PTR(-EINVAL);
-	tun = tun_get(file);
+	tfile = file->private_data;
+	tun = __tun_get(tfile);
 	if (!tun)
 		return ERR_PTR(-EBADFD);
-	tun_put(tun);
-	return &tun->socket;
+	tun_put(tfile);
+	return &tfile->socket;
 }
 EXPORT_SYMBOL_GPL(tun_get_socket);
 
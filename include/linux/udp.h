@@ -28,6 +28,7 @@ struct udphdr {
 
 /* UDP socket options */
 #define UDP_CORK	1	/* Never send partially complete segments */
+#define UDP_PERCPU_RXQ	2	/* Queue received datagrams per cpu */
 #define UDP_ENCAP	100	/* Set the socket to accept encapsulated packets */
 
 /* UDP encapsulation types */
@@ -76,11 +77,18 @@ struct udp_sock {
 #define UDPLITE_SEND_CC  0x2  		/* set via udplite setsockopt         */
 #define UDPLITE_RECV_CC  0x4		/* set via udplite setsocktopt        */
 	__u8		 pcflag;        /* marks socket as UDP-Lite if > 0    */
-	__u8		 unused[3];
+	__u8		 percpu_rxq;	/* Receive via the per-cpu rxq below */
+	__u8		 unused[2];
 	/*
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * Per-cpu receive queues, spliced onto sk_receive_queue by the
+	 * reader. Allocated on first use of UDP_PERCPU_RXQ.
+	 */
+	struct sk_buff_head __percpu *rxq;
+	void		(*rxq_old_destruct)(struct sock *sk);
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -283,9 +283,15 @@ enum xfrm_attr_type_t {
 	XFRMA_KMADDRESS,        /* struct xfrm_user_kmaddress */
 	XFRMA_ALG_AUTH_TRUNC,	/* struct xfrm_algo_auth */
 	XFRMA_MARK,		/* struct xfrm_mark */
+	__XFRMA_UNUSED_22,	/* numbered as in mainline, not supported */
+	__XFRMA_UNUSED_23,
+	XFRMA_SA_EXTRA_FLAGS,	/* __u32, XFRM_SA_XFLAG_* */
 	__XFRMA_MAX
 
 #define XFRMA_MAX (__XFRMA_MAX - 1)
+
+/* Well clear of the flags mainline allocates from the bottom */
+#define XFRM_SA_XFLAG_PARALLEL	0x80000000	/* ESP crypto through pcrypt */
 };
 
 struct xfrm_mark {
@@ -26,6 +26,9 @@ struct inet_peer {
 	atomic_t		ip_id_count;	/* IP ID for the next packet */
 	__u32			tcp_ts;
 	__u32			tcp_ts_stamp;
+	__u16			tcp_fastopen_mss;  /* Fast Open client cache */
+	__s8			tcp_fastopen_len;
+	__u8			tcp_fastopen_cookie[16];
 };
 
 void			inet_initpeers(void) __init;
@@ -60,6 +60,7 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	__be32			nh_gw;
+	struct rtable * __percpu *nh_pcpu_rth_input;
 };
 
 /*
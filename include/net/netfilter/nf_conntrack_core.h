@@ -74,6 +74,13 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
-extern spinlock_t nf_conntrack_lock ;
+/* Protects expectations, helper assignment and ctnetlink updates */
+extern spinlock_t nf_conntrack_expect_lock ;
+
+/* Hash chains are protected by one of these, chosen by bucket number */
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
 
 #endif /* _NF_CONNTRACK_CORE_H */
@@ -173,6 +173,9 @@ extern void	udp_flush_pending_frames(struct sock *sk);
 extern int	udp_rcv(struct sk_buff *skb);
 extern int	udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int	udp_disconnect(struct sock *sk, int flags);
+extern int	udp_rxq_queue_rcv_skb(struct sock *sk, struct sk_buff *skb);
+extern struct sk_buff *udp_recv_datagram(struct sock *sk, unsigned flags,
+					 int *peeked, int *err);
 extern unsigned int udp_poll(struct file *file, struct socket *sock,
 			     poll_table *wait);
 extern int 	udp_lib_getsockopt(struct sock *sk, int level, int optname,
@@ -155,6 +155,7 @@ struct xfrm_state {
 		u8		aalgo, ealgo, calgo;
 		u8		flags;
 		u16		family;
+		u32		extra_flags;
 		xfrm_address_t	saddr;
 		int		header_len;
 		int		trailer_len;
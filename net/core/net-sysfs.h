@@ -5,4 +5,7 @@ int netdev_kobject_init(void);
 int netdev_register_kobject(struct net_device *);
 void netdev_unregister_kobject(struct net_device *);
 void netdev_initialize_kobject(struct net_device *);
+#ifdef CONFIG_XPS
+void netdev_free_xps_maps(struct net_device *);
+#endif
 #endif
@@ -153,6 +153,7 @@
 #include <linux/wait.h>
 #include <linux/etherdevice.h>
 #include <linux/kthread.h>
+#include <linux/jhash.h>
 #include <net/net_namespace.h>
 #include <net/checksum.h>
 #include <net/ipv6.h>
@@ -205,25 +206,40 @@
 #define PKTGEN_MAGIC 0xbe9be955
 #define PG_PROC_DIR "pktgen"
 #define PGCTRL	    "pgctrl"
+#define PGRX	    "pgrx"
 static struct proc_dir_entry *pg_proc_dir;
 
 #define MAX_CFLOWS  65536
 
+#define MAX_IMIX_ENTRIES 20
+#define IMIX_PRECISION	100	/* resolution of the IMIX size distribution */
+
 #define VLAN_TAG_SIZE(x) ((x)->vlan_id == 0xffff ? 0 : 4)
 #define SVLAN_TAG_SIZE(x) ((x)->svlan_id == 0xffff ? 0 : 4)
 
 struct flow_state {
 	__be32 cur_daddr;
+	__be32 cur_saddr;
+	struct in6_addr cur_in6_daddr;
+	__u16 cur_udp_dst;
+	__u16 cur_udp_src;
 	int count;
 #ifdef CONFIG_XFRM
 	struct xfrm_state *x;
 #endif
 	__u32 flags;
+	__u32 seq_num;		/* stamped instead of pkt_dev->seq_num */
 };
 
 /* flow flag bits */
 #define F_INIT   (1<<0)		/* flow has been initialized */
 
+struct imix_pkt {
+	__u32 size;
+	__u32 weight;
+	__u64 count_so_far;
+};
+
 struct pktgen_dev {
 	/*
 	 * Try to keep frequent/infrequent used vars. separated.
@@ -370,6 +386,11 @@ struct pktgen_dev {
 	unsigned nflows;	/* accumulated flows (stats) */
 	unsigned curfl;		/* current sequenced flow (state)*/
 
+	/* IMIX: weighted packet sizes, overrides min/max_pkt_size */
+	struct imix_pkt imix_entries[MAX_IMIX_ENTRIES];
+	unsigned n_imix_entries;
+	__u8 imix_distribution[IMIX_PRECISION];
+
 	u16 queue_map_min;
 	u16 queue_map_max;
 
@@ -431,6 +452,7 @@ static struct pktgen_dev *pktgen_find_dev(struct pktgen_thread *t,
 static int pktgen_device_event(struct notifier_block *, unsigned long, void *);
 static void pktgen_run_all_threads(void);
 static void pktgen_reset_all_threads(void);
+static void pgrx_disable(void);
 static void pktgen_stop_all_threads_ifs(void);
 
 static void pktgen_stop(struct pktgen_thread *t);
@@ -534,6 +556,15 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "     flows: %u flowlen: %u\n", pkt_dev->cflows,
 		   pkt_dev->lflow);
 
+	if (pkt_dev->n_imix_entries) {
+		unsigned i;
+		seq_printf(seq, "     imix_weights: ");
+		for (i = 0; i < pkt_dev->n_imix_entries; i++)
+			seq_printf(seq, "%u,%u%s", pkt_dev->imix_entries[i].size,
+				   pkt_dev->imix_entries[i].weight,
+				   i == pkt_dev->n_imix_entries-1 ? "\n" : " ");
+	}
+
 	seq_printf(seq,
 		   "     queue_map_min: %u  queue_map_max: %u\n",
 		   pkt_dev->queue_map_min,
@@ -699,6 +730,16 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 
 	seq_printf(seq, "     flows: %u\n", pkt_dev->nflows);
 
+	if (pkt_dev->n_imix_entries) {
+		unsigned i;
+		seq_printf(seq, "     imix_size_counts: ");
+		for (i = 0; i < pkt_dev->n_imix_entries; i++)
+			seq_printf(seq, "%u,%llu%s", pkt_dev->imix_entries[i].size,
+				   (unsigned long long)
+				   pkt_dev->imix_entries[i].count_so_far,
+				   i == pkt_dev->n_imix_entries-1 ? "\n" : " ");
+	}
+
 	if (pkt_dev->result[0])
 		seq_printf(seq, "Result: %s\n", pkt_dev->result);
 	else
@@ -828,6 +869,81 @@ static ssize_t get_labels(const char __user *buffer, struct pktgen_dev *pkt_dev)
 	return i;
 }
 
+/* "size,weight size,weight ...", or "0" to go back to min/max_pkt_size */
+static ssize_t get_imix_entries(const char __user *buffer,
+				struct pktgen_dev *pkt_dev)
+{
+	unsigned n = 0;
+	char c;
+	ssize_t i = 0;
+	int len;
+
+	pkt_dev->n_imix_entries = 0;
+	do {
+		unsigned long size, weight;
+
+		len = num_arg(&buffer[i], 10, &size);
+		if (len <= 0)
+			return len ? len : -EINVAL;
+		i += len;
+		if (get_user(c, &buffer[i]))
+			return -EFAULT;
+		if (c != ',') {
+			if (n == 0 && size == 0)
+				return i;
+			return -EINVAL;
+		}
+		i++;
+
+		len = num_arg(&buffer[i], 10, &weight);
+		if (len <= 0)
+			return len ? len : -EINVAL;
+		if (weight == 0 || weight > 0xffff)
+			return -EINVAL;
+		i += len;
+
+		if (n >= MAX_IMIX_ENTRIES)
+			return -E2BIG;
+		if (size < 14 + 20 + 8)
+			size = 14 + 20 + 8;
+		if (size > pkt_dev->odev->mtu + ETH_HLEN)
+			return -EINVAL;
+		pkt_dev->imix_entries[n].size = size;
+		pkt_dev->imix_entries[n].weight = weight;
+		pkt_dev->imix_entries[n].count_so_far = 0;
+		n++;
+
+		if (get_user(c, &buffer[i]))
+			return -EFAULT;
+		i++;
+	} while (c == ' ');
+
+	pkt_dev->n_imix_entries = n;
+	return i;
+}
+
+/* Spread the entries over IMIX_PRECISION slots according to their
+ * weights, so that picking a size is a single random lookup.
+ */
+static void fill_imix_distribution(struct pktgen_dev *pkt_dev)
+{
+	unsigned total = 0, cumulative = 0;
+	unsigned i, j = 0, limit;
+
+	for (i = 0; i < pkt_dev->n_imix_entries; i++)
+		total += pkt_dev->imix_entries[i].weight;
+
+	limit = pkt_dev->imix_entries[0].weight * IMIX_PRECISION / total;
+	for (i = 0; i < IMIX_PRECISION; i++) {
+		while (i >= limit && j < pkt_dev->n_imix_entries - 1) {
+			cumulative += pkt_dev->imix_entries[j++].weight;
+			limit = (cumulative + pkt_dev->imix_entries[j].weight) *
+				IMIX_PRECISION / total;
+		}
+		pkt_dev->imix_distribution[i] = j;
+	}
+}
+
 static ssize_t pktgen_if_write(struct file *file,
 			       const char __user * user_buffer, size_t count,
 			       loff_t * offset)
@@ -1468,6 +1584,26 @@ static ssize_t pktgen_if_write(struct file *file,
 		return count;
 	}
 
+	if (!strcmp(name, "imix_weights")) {
+		unsigned n, cnt;
+
+		len = get_imix_entries(&user_buffer[i], pkt_dev);
+		if (len < 0)
+			return len;
+		i += len;
+		if (pkt_dev->n_imix_entries)
+			fill_imix_distribution(pkt_dev);
+		cnt = sprintf(pg_result, "OK: imix_weights=");
+		for (n = 0; n < pkt_dev->n_imix_entries; n++)
+			cnt += sprintf(pg_result + cnt, "%u,%u%s",
+				       pkt_dev->imix_entries[n].size,
+				       pkt_dev->imix_entries[n].weight,
+				       n == pkt_dev->n_imix_entries-1 ? "" : " ");
+		if (!pkt_dev->n_imix_entries)
+			sprintf(pg_result + cnt, "0");
+		return count;
+	}
+
 	if (!strcmp(name, "queue_map_min")) {
 		len = num_arg(&user_buffer[i], 5, &value);
 		if (len < 0)
@@ -1813,6 +1949,364 @@ static const struct file_operations pktgen_thread_fops = {
 	.release = single_release,
 };
 
+/*
+ * Receive side: count the pktgen packets arriving on one interface, per
+ * flow (address pair and UDP ports), from the sequence numbers and
+ * timestamps the sender puts in struct pktgen_hdr.
+ */
+
+#define PGRX_HASH_BITS	8
+#define PGRX_HASH_SIZE	(1 << PGRX_HASH_BITS)
+#define PGRX_MAX_FLOWS	1024
+
+struct pgrx_key {
+	__be32 saddr[4];
+	__be32 daddr[4];
+	__be16 sport;
+	__be16 dport;
+	__u32 family;
+};
+
+struct pgrx_flow {
+	struct hlist_node hlist;
+	struct rcu_head rcu;
+	struct pgrx_key key;
+
+	spinlock_t lock;	/* protects the counters below */
+	__u64 packets;
+	__u64 bytes;
+	__u64 lost;
+	__u64 reordered;
+	__u32 next_seq;
+	__u32 lat_min;		/* usec */
+	__u32 lat_max;
+	__u64 lat_sum;
+	__u64 lat_cnt;
+};
+
+static struct hlist_head pgrx_hash[PGRX_HASH_SIZE];
+static DEFINE_SPINLOCK(pgrx_lock);	/* protects pgrx_hash insert/remove */
+static unsigned int pgrx_nflows;
+static atomic_long_t pgrx_untracked;	/* packets over PGRX_MAX_FLOWS */
+static u32 pgrx_hashrnd __read_mostly;
+
+static struct net_device *pgrx_dev;	/* under RTNL */
+
+static inline unsigned int pgrx_hashfn(const struct pgrx_key *key)
+{
+	return jhash2((const u32 *)key, sizeof(*key) / sizeof(u32),
+		      pgrx_hashrnd) & (PGRX_HASH_SIZE - 1);
+}
+
+static struct pgrx_flow *pgrx_flow_find(const struct pgrx_key *key)
+{
+	struct hlist_head *head = &pgrx_hash[pgrx_hashfn(key)];
+	struct hlist_node *node;
+	struct pgrx_flow *f;
+
+	hlist_for_each_entry_rcu(f, node, head, hlist)
+		if (!memcmp(&f->key, key, sizeof(*key)))
+			return f;
+	return NULL;
+}
+
+static struct pgrx_flow *pgrx_flow_create(const struct pgrx_key *key)
+{
+	struct pgrx_flow *f;
+
+	spin_lock(&pgrx_lock);
+	f = pgrx_flow_find(key);
+	if (f)
+		goto out;
+	if (pgrx_nflows >= PGRX_MAX_FLOWS)
+		goto out;
+
+	f = kzalloc(sizeof(*f), GFP_ATOMIC);
+	if (!f)
+		goto out;
+	f->key = *key;
+	spin_lock_init(&f->lock);
+	f->lat_min = ~0U;
+	hlist_add_head_rcu(&f->hlist, &pgrx_hash[pgrx_hashfn(key)]);
+	pgrx_nflows++;
+out:
+	spin_unlock(&pgrx_lock);
+	return f;
+}
+
+static void pgrx_flow_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct pgrx_flow, rcu));
+}
+
+static void pgrx_flush(void)
+{
+	struct hlist_node *node, *tmp;
+	struct pgrx_flow *f;
+	int i;
+
+	spin_lock_bh(&pgrx_lock);
+	for (i = 0; i < PGRX_HASH_SIZE; i++) {
+		hlist_for_each_entry_safe(f, node, tmp, &pgrx_hash[i], hlist) {
+			hlist_del_rcu(&f->hlist);
+			call_rcu(&f->rcu, pgrx_flow_free_rcu);
+		}
+	}
+	pgrx_nflows = 0;
+	atomic_long_set(&pgrx_untracked, 0);
+	spin_unlock_bh(&pgrx_lock);
+}
+
+static void pgrx_account(struct pgrx_flow *f, unsigned int len,
+			 const struct pktgen_hdr *pgh)
+{
+	struct timeval now;
+	__u32 seq = ntohl(pgh->seq_num);
+	s64 lat;
+
+	do_gettimeofday(&now);
+	lat = (s64)((s32)(now.tv_sec - ntohl(pgh->tv_sec))) * USEC_PER_SEC +
+		(now.tv_usec - (long)ntohl(pgh->tv_usec));
+
+	spin_lock(&f->lock);
+	/* seq 1 is a new run, or a sender flow re-initialised on this tuple */
+	if (f->packets == 0 || seq == f->next_seq || seq == 1) {
+		f->next_seq = seq + 1;
+	} else if ((s32)(seq - f->next_seq) > 0) {
+		f->lost += seq - f->next_seq;
+		f->next_seq = seq + 1;
+	} else {
+		/* Late arrival: it was counted as lost when the gap opened */
+		f->reordered++;
+		if (f->lost)
+			f->lost--;
+	}
+	f->packets++;
+	f->bytes += len;
+
+	/* Only meaningful with synchronised clocks; skip obvious skew */
+	if (lat >= 0 && lat <= UINT_MAX) {
+		if (lat < f->lat_min)
+			f->lat_min = lat;
+		if (lat > f->lat_max)
+			f->lat_max = lat;
+		f->lat_sum += lat;
+		f->lat_cnt++;
+	}
+	spin_unlock(&f->lock);
+}
+
+static int pktgen_rcv(struct sk_buff *skb, struct net_device *dev,
+		      struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct pktgen_hdr _pgh;
+	const struct pktgen_hdr *pgh;
+	struct udphdr _uh;
+	const struct udphdr *uh;
+	struct pgrx_key key;
+	struct pgrx_flow *f;
+	unsigned int off;
+
+	if (skb->pkt_type == PACKET_OTHERHOST)
+		goto out;
+
+	memset(&key, 0, sizeof(key));
+	if (skb->protocol == htons(ETH_P_IP)) {
+		struct iphdr _iph;
+		const struct iphdr *iph;
+
+		iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+		if (!iph || iph->ihl < 5 || iph->protocol != IPPROTO_UDP ||
+		    (iph->frag_off & htons(IP_MF | IP_OFFSET)))
+			goto out;
+		key.saddr[0] = iph->saddr;
+		key.daddr[0] = iph->daddr;
+		off = iph->ihl * 4;
+	} else {
+		struct ipv6hdr _ip6h;
+		const struct ipv6hdr *ip6h;
+
+		ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+		if (!ip6h || ip6h->nexthdr != IPPROTO_UDP)
+			goto out;
+		memcpy(key.saddr, &ip6h->saddr, sizeof(key.saddr));
+		memcpy(key.daddr, &ip6h->daddr, sizeof(key.daddr));
+		off = sizeof(*ip6h);
+	}
+	key.family = ntohs(skb->protocol);
+
+	uh = skb_header_pointer(skb, off, sizeof(_uh), &_uh);
+	if (!uh)
+		goto out;
+	pgh = skb_header_pointer(skb, off + sizeof(_uh), sizeof(_pgh), &_pgh);
+	if (!pgh || pgh->pgh_magic != htonl(PKTGEN_MAGIC))
+		goto out;
+	key.sport = uh->source;
+	key.dport = uh->dest;
+
+	rcu_read_lock();
+	f = pgrx_flow_find(&key);
+	if (!f)
+		f = pgrx_flow_create(&key);
+	if (f)
+		pgrx_account(f, skb->len, pgh);
+	else
+		atomic_long_inc(&pgrx_untracked);
+	rcu_read_unlock();
+out:
+	consume_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static struct packet_type pgrx_packet_type __read_mostly = {
+	.type = cpu_to_be16(ETH_P_IP),
+	.func = pktgen_rcv,
+};
+
+static struct packet_type pgrx_packet_type_v6 __read_mostly = {
+	.type = cpu_to_be16(ETH_P_IPV6),
+	.func = pktgen_rcv,
+};
+
+/* Both called under RTNL */
+static void pgrx_disable(void)
+{
+	if (!pgrx_dev)
+		return;
+
+	dev_remove_pack(&pgrx_packet_type);
+	dev_remove_pack(&pgrx_packet_type_v6);
+	dev_put(pgrx_dev);
+	pgrx_dev = NULL;
+}
+
+static int pgrx_enable(const char *ifname)
+{
+	struct net_device *dev;
+
+	dev = dev_get_by_name(&init_net, ifname);
+	if (!dev)
+		return -ENODEV;
+
+	pgrx_disable();
+	pgrx_dev = dev;
+	pgrx_packet_type.dev = dev;
+	pgrx_packet_type_v6.dev = dev;
+	dev_add_pack(&pgrx_packet_type);
+	dev_add_pack(&pgrx_packet_type_v6);
+	return 0;
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	struct hlist_node *node;
+	struct pgrx_flow *f;
+	int i;
+
+	rtnl_lock();
+	seq_printf(seq, "rx: %s\n", pgrx_dev ? pgrx_dev->name : "(disabled)");
+	rtnl_unlock();
+	seq_printf(seq, "flows: %u untracked: %lu\n", pgrx_nflows,
+		   atomic_long_read(&pgrx_untracked));
+
+	rcu_read_lock();
+	for (i = 0; i < PGRX_HASH_SIZE; i++) {
+		hlist_for_each_entry_rcu(f, node, &pgrx_hash[i], hlist) {
+			__u64 packets, bytes, lost, reordered, lat_avg = 0;
+			__u32 lat_min, lat_max;
+
+			spin_lock_bh(&f->lock);
+			packets = f->packets;
+			bytes = f->bytes;
+			lost = f->lost;
+			reordered = f->reordered;
+			lat_min = f->lat_cnt ? f->lat_min : 0;
+			lat_max = f->lat_max;
+			if (f->lat_cnt)
+				lat_avg = div64_u64(f->lat_sum, f->lat_cnt);
+			spin_unlock_bh(&f->lock);
+
+			if (f->key.family == ETH_P_IP)
+				seq_printf(seq, "%pI4:%u -> %pI4:%u",
+					   f->key.saddr, ntohs(f->key.sport),
+					   f->key.daddr, ntohs(f->key.dport));
+			else
+				seq_printf(seq, "[%pI6]:%u -> [%pI6]:%u",
+					   f->key.saddr, ntohs(f->key.sport),
+					   f->key.daddr, ntohs(f->key.dport));
+			seq_printf(seq, " pkts: %llu bytes: %llu lost: %llu "
+				   "reordered: %llu latency(usec) "
+				   "min: %u avg: %llu max: %u\n",
+				   (unsigned long long)packets,
+				   (unsigned long long)bytes,
+				   (unsigned long long)lost,
+				   (unsigned long long)reordered,
+				   lat_min, (unsigned long long)lat_avg,
+				   lat_max);
+		}
+	}
+	rcu_read_unlock();
+	return 0;
+}
+
+static ssize_t pgrx_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	int err = 0;
+	char data[128];
+
+	if (!capable(CAP_NET_ADMIN)) {
+		err = -EPERM;
+		goto out;
+	}
+
+	if (count == 0)
+		return -EINVAL;
+
+	if (count > sizeof(data))
+		count = sizeof(data);
+
+	if (copy_from_user(data, buf, count)) {
+		err = -EFAULT;
+		goto out;
+	}
+	data[count - 1] = 0;	/* Make string */
+
+	if (!strncmp(data, "rx ", 3)) {
+		rtnl_lock();
+		err = pgrx_enable(strim(data + 3));
+		rtnl_unlock();
+		if (err)
+			goto out;
+	} else if (!strcmp(data, "rx_reset")) {
+		pgrx_flush();
+	} else if (!strcmp(data, "rx_disable")) {
+		rtnl_lock();
+		pgrx_disable();
+		rtnl_unlock();
+	} else
+		printk(KERN_WARNING "pktgen: Unknown command: %s\n", data);
+
+	err = count;
+
+out:
+	return err;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, PDE(inode)->data);
+}
+
+static const struct file_operations pgrx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = pgrx_write,
+	.release = single_release,
+};
+
 /* Think find or remove for NN */
 static struct pktgen_dev *__pktgen_NN_threads(const char *ifname, int remove)
 {
@@ -1915,6 +2409,8 @@ static int pktgen_device_event(struct notifier_block *unused,
 
 	case NETDEV_UNREGISTER:
 		pktgen_mark_device(dev->name);
+		if (dev == pgrx_dev)
+			pgrx_disable();
 		break;
 	}
 
@@ -2152,6 +2648,16 @@ static inline void set_pkt_overhead(struct pktgen_dev *pkt_dev)
 	pkt_dev->pkt_overhead += SVLAN_TAG_SIZE(pkt_dev);
 }
 
+/* With flows configured every flow is numbered on its own, so that the
+ * receive side can tell loss and reordering apart per flow.
+ */
+static inline __u32 pktgen_seq_num(const struct pktgen_dev *pkt_dev)
+{
+	if (pkt_dev->cflows)
+		return pkt_dev->flows[pkt_dev->curfl].seq_num;
+	return pkt_dev->seq_num;
+}
+
 static inline int f_seen(const struct pktgen_dev *pkt_dev, int flow)
 {
 	return !!(pkt_dev->flows[flow].flags & F_INIT);
@@ -2232,13 +2738,132 @@ static void set_cur_queue_map(struct pktgen_dev *pkt_dev)
 	pkt_dev->cur_queue_map  = pkt_dev->cur_queue_map % pkt_dev->odev->real_num_tx_queues;
 }
 
+/* Pick the next UDP ports and addresses */
+static void mod_cur_tuple(struct pktgen_dev *pkt_dev)
+{
+	__u32 imn;
+	__u32 imx;
+
+	if (pkt_dev->udp_src_min < pkt_dev->udp_src_max) {
+		if (pkt_dev->flags & F_UDPSRC_RND)
+			pkt_dev->cur_udp_src = random32() %
+				(pkt_dev->udp_src_max - pkt_dev->udp_src_min)
+				+ pkt_dev->udp_src_min;
+
+		else {
+			pkt_dev->cur_udp_src++;
+			if (pkt_dev->cur_udp_src >= pkt_dev->udp_src_max)
+				pkt_dev->cur_udp_src = pkt_dev->udp_src_min;
+		}
+	}
+
+	if (pkt_dev->udp_dst_min < pkt_dev->udp_dst_max) {
+		if (pkt_dev->flags & F_UDPDST_RND) {
+			pkt_dev->cur_udp_dst = random32() %
+				(pkt_dev->udp_dst_max - pkt_dev->udp_dst_min)
+				+ pkt_dev->udp_dst_min;
+		} else {
+			pkt_dev->cur_udp_dst++;
+			if (pkt_dev->cur_udp_dst >= pkt_dev->udp_dst_max)
+				pkt_dev->cur_udp_dst = pkt_dev->udp_dst_min;
+		}
+	}
+
+	if (!(pkt_dev->flags & F_IPV6)) {
+
+		imn = ntohl(pkt_dev->saddr_min);
+		imx = ntohl(pkt_dev->saddr_max);
+		if (imn < imx) {
+			__u32 t;
+			if (pkt_dev->flags & F_IPSRC_RND)
+				t = random32() % (imx - imn) + imn;
+			else {
+				t = ntohl(pkt_dev->cur_saddr);
+				t++;
+				if (t > imx)
+					t = imn;
+
+			}
+			pkt_dev->cur_saddr = htonl(t);
+		}
+
+		imn = ntohl(pkt_dev->daddr_min);
+		imx = ntohl(pkt_dev->daddr_max);
+		if (imn < imx) {
+			__u32 t;
+			__be32 s;
+			if (pkt_dev->flags & F_IPDST_RND) {
+
+				t = random32() % (imx - imn) + imn;
+				s = htonl(t);
+
+				while (ipv4_is_loopback(s) ||
+				       ipv4_is_multicast(s) ||
+				       ipv4_is_lbcast(s) ||
+				       ipv4_is_zeronet(s) ||
+				       ipv4_is_local_multicast(s)) {
+					t = random32() % (imx - imn) + imn;
+					s = htonl(t);
+				}
+				pkt_dev->cur_daddr = s;
+			} else {
+				t = ntohl(pkt_dev->cur_daddr);
+				t++;
+				if (t > imx) {
+					t = imn;
+				}
+				pkt_dev->cur_daddr = htonl(t);
+			}
+		}
+	} else {		/* IPV6 * */
+
+		if (pkt_dev->min_in6_daddr.s6_addr32[0] == 0 &&
+		    pkt_dev->min_in6_daddr.s6_addr32[1] == 0 &&
+		    pkt_dev->min_in6_daddr.s6_addr32[2] == 0 &&
+		    pkt_dev->min_in6_daddr.s6_addr32[3] == 0) ;
+		else {
+			int i;
+
+			/* Only random destinations yet */
+
+			for (i = 0; i < 4; i++) {
+				pkt_dev->cur_in6_daddr.s6_addr32[i] =
+				    (((__force __be32)random32() |
+				      pkt_dev->min_in6_daddr.s6_addr32[i]) &
+				     pkt_dev->max_in6_daddr.s6_addr32[i]);
+			}
+		}
+	}
+}
+
+/*
+ * A flow keeps the ports and addresses it starts with until it is
+ * re-initialised, so that the receiver sees one 5-tuple per numbered
+ * sequence.
+ */
+static void f_init(struct pktgen_dev *pkt_dev, int flow)
+{
+	struct flow_state *fs = &pkt_dev->flows[flow];
+
+	fs->flags |= F_INIT;
+	fs->seq_num = 1;
+	fs->cur_udp_src = pkt_dev->cur_udp_src;
+	fs->cur_udp_dst = pkt_dev->cur_udp_dst;
+	fs->cur_saddr = pkt_dev->cur_saddr;
+	fs->cur_daddr = pkt_dev->cur_daddr;
+	fs->cur_in6_daddr = pkt_dev->cur_in6_daddr;
+#ifdef CONFIG_XFRM
+	if (!(pkt_dev->flags & F_IPV6) && (pkt_dev->flags & F_IPSEC_ON))
+		get_ipsec_sa(pkt_dev, flow);
+#endif
+	pkt_dev->nflows++;
+}
+
 /* Increment/randomize headers according to flags and current values
  * for IP src/dest, UDP src/dst port, MAC-Addr src/dst
  */
 static void mod_cur_headers(struct pktgen_dev *pkt_dev)
 {
-	__u32 imn;
-	__u32 imx;
 	int flow = 0;
 
 	if (pkt_dev->cflows)
@@ -2315,109 +2940,18 @@ static void mod_cur_headers(struct pktgen_dev *pkt_dev)
 		pkt_dev->svlan_id = random32() & (4096 - 1);
 	}
 
-	if (pkt_dev->udp_src_min < pkt_dev->udp_src_max) {
-		if (pkt_dev->flags & F_UDPSRC_RND)
-			pkt_dev->cur_udp_src = random32() %
-				(pkt_dev->udp_src_max - pkt_dev->udp_src_min)
-				+ pkt_dev->udp_src_min;
-
-		else {
-			pkt_dev->cur_udp_src++;
-			if (pkt_dev->cur_udp_src >= pkt_dev->udp_src_max)
-				pkt_dev->cur_udp_src = pkt_dev->udp_src_min;
-		}
-	}
-
-	if (pkt_dev->udp_dst_min < pkt_dev->udp_dst_max) {
-		if (pkt_dev->flags & F_UDPDST_RND) {
-			pkt_dev->cur_udp_dst = random32() %
-				(pkt_dev->udp_dst_max - pkt_dev->udp_dst_min)
-				+ pkt_dev->udp_dst_min;
-		} else {
-			pkt_dev->cur_udp_dst++;
-			if (pkt_dev->cur_udp_dst >= pkt_dev->udp_dst_max)
-				pkt_dev->cur_udp_dst = pkt_dev->udp_dst_min;
-		}
-	}
-
-	if (!(pkt_dev->flags & F_IPV6)) {
-
-		imn = ntohl(pkt_dev->saddr_min);
-		imx = ntohl(pkt_dev->saddr_max);
-		if (imn < imx) {
-			__u32 t;
-			if (pkt_dev->flags & F_IPSRC_RND)
-				t = random32() % (imx - imn) + imn;
-			else {
-				t = ntohl(pkt_dev->cur_saddr);
-				t++;
-				if (t > imx)
-					t = imn;
-
-			}
-			pkt_dev->cur_saddr = htonl(t);
-		}
-
-		if (pkt_dev->cflows && f_seen(pkt_dev, flow)) {
-			pkt_dev->cur_daddr = pkt_dev->flows[flow].cur_daddr;
-		} else {
-			imn = ntohl(pkt_dev->daddr_min);
-			imx = ntohl(pkt_dev->daddr_max);
-			if (imn < imx) {
-				__u32 t;
-				__be32 s;
-				if (pkt_dev->flags & F_IPDST_RND) {
-
-					t = random32() % (imx - imn) + imn;
-					s = htonl(t);
+	if (pkt_dev->cflows && f_seen(pkt_dev, flow)) {
+		struct flow_state *fs = &pkt_dev->flows[flow];
 
-					while (ipv4_is_loopback(s) ||
-					       ipv4_is_multicast(s) ||
-					       ipv4_is_lbcast(s) ||
-					       ipv4_is_zeronet(s) ||
-					       ipv4_is_local_multicast(s)) {
-						t = random32() % (imx - imn) + imn;
-						s = htonl(t);
-					}
-					pkt_dev->cur_daddr = s;
-				} else {
-					t = ntohl(pkt_dev->cur_daddr);
-					t++;
-					if (t > imx) {
-						t = imn;
-					}
-					pkt_dev->cur_daddr = htonl(t);
-				}
-			}
-			if (pkt_dev->cflows) {
-				pkt_dev->flows[flow].flags |= F_INIT;
-				pkt_dev->flows[flow].cur_daddr =
-				    pkt_dev->cur_daddr;
-#ifdef CONFIG_XFRM
-				if (pkt_dev->flags & F_IPSEC_ON)
-					get_ipsec_sa(pkt_dev, flow);
-#endif
-				pkt_dev->nflows++;
-			}
-		}
-	} else {		/* IPV6 * */
-
-		if (pkt_dev->min_in6_daddr.s6_addr32[0] == 0 &&
-		    pkt_dev->min_in6_daddr.s6_addr32[1] == 0 &&
-		    pkt_dev->min_in6_daddr.s6_addr32[2] == 0 &&
-		    pkt_dev->min_in6_daddr.s6_addr32[3] == 0) ;
-		else {
-			int i;
-
-			/* Only random destinations yet */
-
-			for (i = 0; i < 4; i++) {
-				pkt_dev->cur_in6_daddr.s6_addr32[i] =
-				    (((__force __be32)random32() |
-				      pkt_dev->min_in6_daddr.s6_addr32[i]) &
-				     pkt_dev->max_in6_daddr.s6_addr32[i]);
-			}
-		}
+		pkt_dev->cur_udp_src = fs->cur_udp_src;
+		pkt_dev->cur_udp_dst = fs->cur_udp_dst;
+		pkt_dev->cur_saddr = fs->cur_saddr;
+		pkt_dev->cur_daddr = fs->cur_daddr;
+		pkt_dev->cur_in6_daddr = fs->cur_in6_daddr;
+	} else {
+		mod_cur_tuple(pkt_dev);
+		if (pkt_dev->cflows)
+			f_init(pkt_dev, flow);
 	}
 
 	if (pkt_dev->min_pkt_size < pkt_dev->max_pkt_size) {
@@ -2434,6 +2968,15 @@ static void mod_cur_headers(struct pktgen_dev *pkt_dev)
 		pkt_dev->cur_pkt_size = t;
 	}
 
+	if (pkt_dev->n_imix_entries) {
+		struct imix_pkt *e;
+
+		e = &pkt_dev->imix_entries[pkt_dev->imix_distribution[
+				random32() % IMIX_PRECISION]];
+		e->count_so_far++;
+		pkt_dev->cur_pkt_size = e->size;
+	}
+
 	set_cur_queue_map(pkt_dev);
 
 	pkt_dev->flows[flow].count++;
@@ -2709,7 +3252,7 @@ static struct sk_buff *fill_packet_ipv4(struct net_device *odev,
 		struct timeval timestamp;
 
 		pgh->pgh_magic = htonl(PKTGEN_MAGIC);
-		pgh->seq_num = htonl(pkt_dev->seq_num);
+		pgh->seq_num = htonl(pktgen_seq_num(pkt_dev));
 
 		do_gettimeofday(&timestamp);
 		pgh->tv_sec = htonl(timestamp.tv_sec);
@@ -3060,7 +3603,7 @@ static struct sk_buff *fill_packet_ipv6(struct net_device *odev,
 		struct timeval timestamp;
 
 		pgh->pgh_magic = htonl(PKTGEN_MAGIC);
-		pgh->seq_num = htonl(pkt_dev->seq_num);
+		pgh->seq_num = htonl(pktgen_seq_num(pkt_dev));
 
 		do_gettimeofday(&timestamp);
 		pgh->tv_sec = htonl(timestamp.tv_sec);
@@ -3082,11 +3625,18 @@ static struct sk_buff *fill_packet(struct net_device *odev,
 
 static void pktgen_clear_counters(struct pktgen_dev *pkt_dev)
 {
+	unsigned i;
+
 	pkt_dev->seq_num = 1;
 	pkt_dev->idle_acc = 0;
 	pkt_dev->sofar = 0;
 	pkt_dev->tx_bytes = 0;
 	pkt_dev->errors = 0;
+
+	for (i = 0; i < pkt_dev->cflows; i++)
+		pkt_dev->flows[i].seq_num = 1;
+	for (i = 0; i < pkt_dev->n_imix_entries; i++)
+		pkt_dev->imix_entries[i].count_so_far = 0;
 }
 
 /* Set up structure for sending pkts, clear counters */
@@ -3244,9 +3794,13 @@ static void show_results(struct pktgen_dev *pkt_dev, int nr_frags)
 		     pkt_dev->cur_pkt_size, nr_frags);
 
 	pps = div64_u64(pkt_dev->sofar * NSEC_PER_SEC,
-			ktime_to_ns(elapsed));
+			max_t(u64, ktime_to_ns(elapsed), 1));
 
-	bps = pps * 8 * pkt_dev->cur_pkt_size;
+	if (pkt_dev->n_imix_entries)
+		bps = div64_u64(pkt_dev->tx_bytes * 8 * USEC_PER_SEC,
+				max_t(u64, ktime_to_us(elapsed), 1));
+	else
+		bps = pps * 8 * pkt_dev->cur_pkt_size;
 
 	mbps = bps;
 	do_div(mbps, 1000000);
@@ -3449,7 +4003,7 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 	__netif_tx_lock_bh(txq);
 
-	if (unlikely(netif_tx_queue_stopped(txq) || netif_tx_queue_frozen(txq))) {
+	if (unlikely(netif_xmit_frozen_or_stopped(txq))) {
 		ret = NETDEV_TX_BUSY;
 		pkt_dev->last_ok = 0;
 		goto unlock;
@@ -3463,6 +4017,8 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		pkt_dev->last_ok = 1;
 		pkt_dev->sofar++;
 		pkt_dev->seq_num++;
+		if (pkt_dev->cflows)
+			pkt_dev->flows[pkt_dev->curfl].seq_num++;
 		pkt_dev->tx_bytes += pkt_dev->last_pkt_size;
 		break;
 	case NET_XMIT_DROP:
@@ -3823,6 +4379,16 @@ static int __init pg_init(void)
 		return -EINVAL;
 	}
 
+	pe = proc_create(PGRX, 0600, pg_proc_dir, &pgrx_fops);
+	if (pe == NULL) {
+		printk(KERN_ERR "pktgen: ERROR: cannot create %s "
+		       "procfs entry.\n", PGRX);
+		remove_proc_entry(PGCTRL, pg_proc_dir);
+		proc_net_remove(&init_net, PG_PROC_DIR);
+		return -EINVAL;
+	}
+	get_random_bytes(&pgrx_hashrnd, sizeof(pgrx_hashrnd));
+
 	/* Register us to receive netdevice events */
 	register_netdevice_notifier(&pktgen_notifier_block);
 
@@ -3839,6 +4405,7 @@ static int __init pg_init(void)
 		printk(KERN_ERR "pktgen: ERROR: Initialization failed for "
 		       "all threads\n");
 		unregister_netdevice_notifier(&pktgen_notifier_block);
+		remove_proc_entry(PGRX, pg_proc_dir);
 		remove_proc_entry(PGCTRL, pg_proc_dir);
 		proc_net_remove(&init_net, PG_PROC_DIR);
 		return -ENODEV;
@@ -3865,7 +4432,15 @@ static void __exit pg_cleanup(void)
 	/* Un-register us from receiving netdevice events */
 	unregister_netdevice_notifier(&pktgen_notifier_block);
 
+	/* Stop receive side accounting and wait for the flows to be freed */
+	rtnl_lock();
+	pgrx_disable();
+	rtnl_unlock();
+	pgrx_flush();
+	rcu_barrier();
+
 	/* Clean up proc file system */
+	remove_proc_entry(PGRX, pg_proc_dir);
 	remove_proc_entry(PGCTRL, pg_proc_dir);
 	proc_net_remove(&init_net, PG_PROC_DIR);
 }
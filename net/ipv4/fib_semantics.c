@@ -145,6 +145,10 @@ void free_fib_info(struct fib_info *fi)
 		return;
 	}
 	change_nexthops(fi) {
+		if (nexthop_nh->nh_pcpu_rth_input) {
+			ip_rt_nh_cache_release(nexthop_nh->nh_pcpu_rth_input);
+			free_percpu(nexthop_nh->nh_pcpu_rth_input);
+		}
 		if (nexthop_nh->nh_dev)
 			dev_put(nexthop_nh->nh_dev);
 		nexthop_nh->nh_dev = NULL;
@@ -825,6 +829,16 @@ link_it:
 		return ofi;
 	}
 
+	/* Only gateway next hops use the forwarding route cache */
+	change_nexthops(fi) {
+		if (!nexthop_nh->nh_gw)
+			continue;
+		nexthop_nh->nh_pcpu_rth_input = alloc_percpu(struct rtable *);
+		err = -ENOMEM;
+		if (!nexthop_nh->nh_pcpu_rth_input)
+			goto failure;
+	} endfor_nexthops(fi)
+
 	fi->fib_treeref++;
 	atomic_inc(&fi->fib_clntref);
 	spin_lock_bh(&fib_info_lock);
@@ -212,6 +212,10 @@ static void ip_expire(unsigned long arg)
 		if (!head->dev)
 			goto out_rcu_unlock;
 
+		/* A packet socket is not an end host, keep quiet */
+		if (qp->user == IP_DEFRAG_AF_PACKET)
+			goto out_rcu_unlock;
+
 		/*
 		 * Only search router table for the head fragment,
 		 * when defraging timeout at PRE_ROUTING HOOK.
@@ -624,6 +628,50 @@ int ip_defrag(struct sk_buff *skb, u32 user)
 	return -ENOMEM;
 }
 
+/*
+ * Reassemble an IPv4 datagram seen by a packet tap. Non-fragments and
+ * anything that does not look like a sane IPv4 header are returned
+ * unchanged; NULL means the fragment was queued for reassembly.
+ *
+ * ip_defrag() expects skb->data to point at the IP header, which holds
+ * for received frames only; transmitted ones are passed through as is.
+ */
+struct sk_buff *ip_check_defrag(struct sk_buff *skb, u32 user)
+{
+	const struct iphdr *iph;
+	u32 len;
+
+	if (skb->protocol != htons(ETH_P_IP) || skb_network_offset(skb))
+		return skb;
+
+	if (!pskb_may_pull(skb, sizeof(struct iphdr)))
+		return skb;
+
+	iph = ip_hdr(skb);
+	if (iph->ihl < 5 || iph->version != 4)
+		return skb;
+	if (!pskb_may_pull(skb, iph->ihl * 4))
+		return skb;
+	iph = ip_hdr(skb);
+	len = ntohs(iph->tot_len);
+	if (skb->len < len || len < iph->ihl * 4)
+		return skb;
+
+	if (iph->frag_off & htons(IP_MF | IP_OFFSET)) {
+		skb = skb_share_check(skb, GFP_ATOMIC);
+		if (skb) {
+			if (pskb_trim_rcsum(skb, len))
+				return skb;
+			memset(IPCB(skb), 0, sizeof(struct inet_skb_parm));
+			if (ip_defrag(skb, user))
+				return NULL;
+			skb->rxhash = 0;
+		}
+	}
+	return skb;
+}
+EXPORT_SYMBOL(ip_check_defrag);
+
 #ifdef CONFIG_SYSCTL
 static int zero;
 
@@ -24,8 +24,10 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/sort.h>
 
 #include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
@@ -314,6 +316,379 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+#ifdef CONFIG_IP_NF_IPTABLES_CLASSIFY
+/*
+ * Rule classifier.
+ *
+ * When a table is loaded every rule is projected onto a few header
+ * fields: addresses, protocol and ports.  Along each field the rules'
+ * ranges cut the value space into elementary intervals, and each
+ * interval carries the bitmap of rules whose range covers it.  A packet
+ * costs one binary search per field; the AND of the bitmaps it lands in
+ * are the rules that can possibly match, and ipt_do_table() skips
+ * straight over all the others.
+ *
+ * The projection is conservative: whatever cannot be expressed as a
+ * single range (inverted or non-prefix masks, matches other than
+ * tcp/udp) is a wildcard, and candidates still go through the complete
+ * match.  Rules that do not match are neither counted nor traced, so
+ * skipping them does not change what the linear walk would do.
+ */
+enum {
+	IPT_CLS_SRC,
+	IPT_CLS_DST,
+	IPT_CLS_PROTO,
+	IPT_CLS_SPORT,
+	IPT_CLS_DPORT,
+	IPT_CLS_FIELDS
+};
+
+/* Small tables are walked faster than classified */
+#define IPT_CLS_MIN_RULES	16
+/* Fall back to the linear walk if the classifier would be bigger */
+#define IPT_CLS_MAX_SIZE	(16 << 20)
+
+#define IPT_CLS_ALIGN		__alignof__(struct ipt_entry)
+
+static const u32 ipt_cls_max[IPT_CLS_FIELDS] = {
+	[IPT_CLS_SRC]	= ~0U,
+	[IPT_CLS_DST]	= ~0U,
+	[IPT_CLS_PROTO]	= 0xff,
+	[IPT_CLS_SPORT]	= 0xffff,
+	[IPT_CLS_DPORT]	= 0xffff,
+};
+
+struct ipt_cls_field {
+	unsigned int	nr;	/* number of elementary intervals */
+	u32		*bound;	/* lower bound of each, ascending from 0 */
+	unsigned long	*bits;	/* nr rule bitmaps, ipt_classifier.words each */
+};
+
+struct ipt_classifier {
+	unsigned int		nr_rules;
+	unsigned int		words;
+	unsigned int		*offset;	/* rule number -> entry offset */
+	unsigned int		*rule;		/* offset / IPT_CLS_ALIGN -> rule */
+	struct ipt_cls_field	field[IPT_CLS_FIELDS];
+};
+
+/* Values of one field a rule can match, inclusive; empty if lo > hi */
+struct ipt_cls_range {
+	u32 lo, hi;
+};
+
+/* Per-packet classification result */
+struct ipt_cls_state {
+	const struct ipt_classifier *cls;
+	unsigned int nr;
+	const unsigned long *vec[IPT_CLS_FIELDS];
+};
+
+static void ipt_cls_addr_range(struct ipt_cls_range *r, __be32 addr,
+			       __be32 mask, bool inv)
+{
+	u32 hmask = ~ntohl(mask);
+
+	/* Only prefixes map onto a single range */
+	if (inv || (hmask & (hmask + 1)) != 0)
+		return;
+	r->lo = ntohl(addr) & ~hmask;
+	r->hi = r->lo | hmask;
+}
+
+static void ipt_cls_port_range(struct ipt_cls_range *r, const u_int16_t *pts,
+			       bool inv)
+{
+	if (inv)
+		return;
+	r->lo = max_t(u32, r->lo, pts[0]);
+	r->hi = min_t(u32, r->hi, pts[1]);
+}
+
+static void ipt_cls_rule_ranges(const struct ipt_entry *e,
+				struct ipt_cls_range *r)
+{
+	const struct ipt_ip *ip = &e->ip;
+	const struct xt_entry_match *ematch;
+	unsigned int f;
+
+	for (f = 0; f < IPT_CLS_FIELDS; f++) {
+		r[f].lo = 0;
+		r[f].hi = ipt_cls_max[f];
+	}
+
+	ipt_cls_addr_range(&r[IPT_CLS_SRC], ip->src.s_addr, ip->smsk.s_addr,
+			   ip->invflags & IPT_INV_SRCIP);
+	ipt_cls_addr_range(&r[IPT_CLS_DST], ip->dst.s_addr, ip->dmsk.s_addr,
+			   ip->invflags & IPT_INV_DSTIP);
+	if (ip->proto && !(ip->invflags & IPT_INV_PROTO))
+		r[IPT_CLS_PROTO].lo = r[IPT_CLS_PROTO].hi = ip->proto;
+
+	/* Ports only narrow through the first match: skipping a rule by
+	 * port must not skip an earlier match with side effects, such as
+	 * limit or recent. */
+	xt_ematch_foreach(ematch, e) {
+		const char *name = ematch->u.kernel.match->name;
+
+		if (strcmp(name, "tcp") == 0) {
+			const struct xt_tcp *tcp = (const void *)ematch->data;
+
+			ipt_cls_port_range(&r[IPT_CLS_SPORT], tcp->spts,
+					   tcp->invflags & XT_TCP_INV_SRCPT);
+			ipt_cls_port_range(&r[IPT_CLS_DPORT], tcp->dpts,
+					   tcp->invflags & XT_TCP_INV_DSTPT);
+		} else if (strcmp(name, "udp") == 0 ||
+			   strcmp(name, "udplite") == 0) {
+			const struct xt_udp *udp = (const void *)ematch->data;
+
+			ipt_cls_port_range(&r[IPT_CLS_SPORT], udp->spts,
+					   udp->invflags & XT_UDP_INV_SRCPT);
+			ipt_cls_port_range(&r[IPT_CLS_DPORT], udp->dpts,
+					   udp->invflags & XT_UDP_INV_DSTPT);
+		}
+		break;
+	}
+}
+
+static int ipt_cls_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Index of the interval holding v */
+static inline unsigned int
+ipt_cls_find(const struct ipt_cls_field *field, u32 v)
+{
+	unsigned int lo = 0, hi = field->nr;
+
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (field->bound[mid] <= v)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* Builds the classifier for a translated table, or returns NULL if it is
+ * too small or too big to be worth it. */
+static void *ipt_cls_build(const struct xt_table_info *info,
+			   const void *entry0)
+{
+	const unsigned int n = info->number;
+	struct ipt_cls_range *ranges;
+	struct ipt_classifier *cls = NULL;
+	u32 *bounds[IPT_CLS_FIELDS] = { NULL };
+	unsigned int nr[IPT_CLS_FIELDS];
+	const struct ipt_entry *iter;
+	unsigned int words, f, i, j;
+	size_t size;
+	void *p;
+
+	if (n < IPT_CLS_MIN_RULES)
+		return NULL;
+
+	ranges = vmalloc(n * IPT_CLS_FIELDS * sizeof(*ranges));
+	if (ranges == NULL)
+		return NULL;
+
+	i = 0;
+	xt_entry_foreach(iter, entry0, info->size)
+		ipt_cls_rule_ranges(iter, &ranges[i++ * IPT_CLS_FIELDS]);
+
+	words = BITS_TO_LONGS(n);
+	size = sizeof(*cls) +
+	       (n + info->size / IPT_CLS_ALIGN) * sizeof(unsigned int);
+
+	/* Interval boundaries: 0 and every range's lo and hi + 1 */
+	for (f = 0; f < IPT_CLS_FIELDS; f++) {
+		u32 *b = vmalloc((2 * n + 1) * sizeof(u32));
+
+		if (b == NULL)
+			goto out;
+		bounds[f] = b;
+
+		j = 0;
+		b[j++] = 0;
+		for (i = 0; i < n; i++) {
+			const struct ipt_cls_range *r =
+				&ranges[i * IPT_CLS_FIELDS + f];
+
+			if (r->lo > r->hi)
+				continue;
+			b[j++] = r->lo;
+			if (r->hi != ipt_cls_max[f])
+				b[j++] = r->hi + 1;
+		}
+		sort(b, j, sizeof(u32), ipt_cls_cmp, NULL);
+
+		nr[f] = 1;
+		for (i = 1; i < j; i++)
+			if (b[i] != b[nr[f] - 1])
+				b[nr[f]++] = b[i];
+
+		size += nr[f] * (sizeof(u32) + words * sizeof(unsigned long));
+	}
+
+	if (size > IPT_CLS_MAX_SIZE) {
+		duprintf("ipt_cls_build: %zu bytes for %u rules, not used\n",
+			 size, n);
+		goto out;
+	}
+
+	cls = vmalloc(size);
+	if (cls == NULL)
+		goto out;
+	memset(cls, 0, size);
+
+	cls->nr_rules = n;
+	cls->words = words;
+	p = cls + 1;
+	for (f = 0; f < IPT_CLS_FIELDS; f++) {
+		cls->field[f].nr = nr[f];
+		cls->field[f].bits = p;
+		p += nr[f] * words * sizeof(unsigned long);
+	}
+	for (f = 0; f < IPT_CLS_FIELDS; f++) {
+		cls->field[f].bound = p;
+		memcpy(p, bounds[f], nr[f] * sizeof(u32));
+		p += nr[f] * sizeof(u32);
+	}
+	cls->offset = p;
+	cls->rule = p + n * sizeof(unsigned int);
+
+	i = 0;
+	xt_entry_foreach(iter, entry0, info->size) {
+		unsigned int off = (const void *)iter - entry0;
+
+		cls->offset[i] = off;
+		cls->rule[off / IPT_CLS_ALIGN] = i;
+
+		for (f = 0; f < IPT_CLS_FIELDS; f++) {
+			const struct ipt_cls_range *r =
+				&ranges[i * IPT_CLS_FIELDS + f];
+			struct ipt_cls_field *field = &cls->field[f];
+
+			if (r->lo > r->hi)
+				continue;
+			for (j = ipt_cls_find(field, r->lo);
+			     j < field->nr && field->bound[j] <= r->hi; j++)
+				__set_bit(i, field->bits + j * words);
+		}
+		++i;
+	}
+
+out:
+	for (f = 0; f < IPT_CLS_FIELDS; f++)
+		vfree(bounds[f]);
+	vfree(ranges);
+	return cls;
+}
+
+static void ipt_cls_lookup(struct ipt_cls_state *st,
+			   const struct xt_table_info *private,
+			   const struct sk_buff *skb,
+			   const struct iphdr *ip,
+			   int fragoff, unsigned int thoff)
+{
+	const struct ipt_classifier *cls = private->classifier;
+	u32 key[IPT_CLS_FIELDS];
+	unsigned int f, nr = IPT_CLS_SPORT;
+
+	st->cls = cls;
+	if (cls == NULL)
+		return;
+
+	key[IPT_CLS_SRC] = ntohl(ip->saddr);
+	key[IPT_CLS_DST] = ntohl(ip->daddr);
+	key[IPT_CLS_PROTO] = ip->protocol;
+
+	/* Without ports the port fields simply do not narrow anything.
+	 * Ports are only used when the tcp/udp match would see a complete
+	 * header; on a truncated one it hotdrops, so the rule must run. */
+	if (fragoff == 0 && ip->protocol == IPPROTO_TCP) {
+		struct tcphdr _tcph;
+		const struct tcphdr *th;
+
+		th = skb_header_pointer(skb, thoff, sizeof(_tcph), &_tcph);
+		if (th != NULL && th->doff * 4 >= sizeof(_tcph)) {
+			key[IPT_CLS_SPORT] = ntohs(th->source);
+			key[IPT_CLS_DPORT] = ntohs(th->dest);
+			nr = IPT_CLS_FIELDS;
+		}
+	} else if (fragoff == 0 && (ip->protocol == IPPROTO_UDP ||
+				    ip->protocol == IPPROTO_UDPLITE)) {
+		struct udphdr _udph;
+		const struct udphdr *uh;
+
+		uh = skb_header_pointer(skb, thoff, sizeof(_udph), &_udph);
+		if (uh != NULL) {
+			key[IPT_CLS_SPORT] = ntohs(uh->source);
+			key[IPT_CLS_DPORT] = ntohs(uh->dest);
+			nr = IPT_CLS_FIELDS;
+		}
+	}
+
+	for (f = 0; f < nr; f++)
+		st->vec[f] = cls->field[f].bits +
+			     ipt_cls_find(&cls->field[f], key[f]) * cls->words;
+	st->nr = nr;
+}
+
+/* First rule at or after e that can match the packet.  Every chain ends
+ * in an unconditional rule, so this never leaves e's chain. */
+static inline struct ipt_entry *
+ipt_cls_skip(const struct ipt_cls_state *st, const void *table_base,
+	     struct ipt_entry *e)
+{
+	const struct ipt_classifier *cls = st->cls;
+	unsigned long word;
+	unsigned int i, w, f;
+
+	if (cls == NULL)
+		return e;
+
+	i = cls->rule[((void *)e - table_base) / IPT_CLS_ALIGN];
+	word = ~0UL << (i % BITS_PER_LONG);
+	for (w = i / BITS_PER_LONG; w < cls->words; w++, word = ~0UL) {
+		for (f = 0; f < st->nr; f++)
+			word &= st->vec[f][w];
+		if (word)
+			return get_entry(table_base,
+				cls->offset[w * BITS_PER_LONG + __ffs(word)]);
+	}
+	return e;
+}
+#else
+struct ipt_cls_state {
+};
+
+static inline void *ipt_cls_build(const struct xt_table_info *info,
+				  const void *entry0)
+{
+	return NULL;
+}
+
+static inline void ipt_cls_lookup(struct ipt_cls_state *st,
+				  const struct xt_table_info *private,
+				  const struct sk_buff *skb,
+				  const struct iphdr *ip,
+				  int fragoff, unsigned int thoff)
+{
+}
+
+static inline struct ipt_entry *
+ipt_cls_skip(const struct ipt_cls_state *st, const void *table_base,
+	     struct ipt_entry *e)
+{
+	return e;
+}
+#endif /* CONFIG_IP_NF_IPTABLES_CLASSIFY */
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -335,6 +710,7 @@ ipt_do_table(struct sk_buff *skb,
 	const struct xt_table_info *private;
 	struct xt_match_param mtpar;
 	struct xt_target_param tgpar;
+	struct ipt_cls_state cls;
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -364,12 +740,15 @@ ipt_do_table(struct sk_buff *skb,
 	/* For return from builtin chain */
 	back = get_entry(table_base, private->underflow[hook]);
 
+	ipt_cls_lookup(&cls, private, skb, ip, mtpar.fragoff, mtpar.thoff);
+
 	do {
 		const struct ipt_entry_target *t;
 		const struct xt_entry_match *ematch;
 
 		IP_NF_ASSERT(e);
 		IP_NF_ASSERT(back);
+		e = ipt_cls_skip(&cls, table_base, e);
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, mtpar.fragoff)) {
  no_match:
@@ -441,9 +820,11 @@ ipt_do_table(struct sk_buff *skb,
 #endif
 		/* Target might have changed stuff. */
 		ip = ip_hdr(skb);
-		if (verdict == IPT_CONTINUE)
+		if (verdict == IPT_CONTINUE) {
+			ipt_cls_lookup(&cls, private, skb, ip,
+				       mtpar.fragoff, mtpar.thoff);
 			e = ipt_next_entry(e);
-		else
+		} else
 			/* Verdict */
 			break;
 	} while (!hotdrop);
@@ -895,6 +1276,7 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+	newinfo->classifier = ipt_cls_build(newinfo, entry0);
 	return ret;
 }
 
@@ -1801,6 +2183,8 @@ translate_compat_table(struct net *net,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+	newinfo->classifier = ipt_cls_build(newinfo, entry1);
+
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
@@ -2095,7 +2479,7 @@ struct xt_table *ipt_register_table(struct net *net,
 	int ret;
 	struct xt_table_info *newinfo;
 	struct xt_table_info bootstrap
-		= { 0, 0, 0, { 0 }, { 0 }, { } };
+		= { 0, 0, 0, { 0 }, { 0 }, NULL, { } };
 	void *loc_cpu_entry;
 	struct xt_table *new_table;
 
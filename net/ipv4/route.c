@@ -1978,6 +1978,82 @@ static void ip_handle_martian_source(struct net_device *dev,
 #endif
 }
 
+/*
+ * Forwarding through a gateway does not depend on the source address,
+ * so such routes are not entered into the hash per (saddr, daddr) pair
+ * but kept as a single entry per next hop and cpu.  A flood of random
+ * source addresses then reuses a handful of entries instead of filling
+ * the cache and driving the garbage collector.  Anything that needs
+ * per-flow state (redirects, IP options, realms, ICMP errors sourced
+ * from the inbound interface) stays in the hash.
+ */
+static bool rt_nh_cacheable(const struct sk_buff *skb,
+			    const struct fib_result *res,
+			    unsigned flags, u32 itag)
+{
+	const struct fib_nh *nh;
+
+	if (!res->fi)
+		return false;
+	nh = &FIB_RES_NH(*res);
+	return nh->nh_pcpu_rth_input && nh->nh_gw &&
+	       nh->nh_scope == RT_SCOPE_LINK &&
+	       !(flags & RTCF_DOREDIRECT) && itag == 0 &&
+	       !dev_net(skb->dev)->ipv4.sysctl_icmp_errors_use_inbound_ifaddr &&
+	       skb->protocol == htons(ETH_P_IP) && ip_hdr(skb)->ihl == 5;
+}
+
+/*
+ * A cached entry is shared by every packet forwarded to the next hop on
+ * this cpu, whatever its addresses or input device, and may still be
+ * attached to queued skbs: it is never modified after being stored.
+ * Its addresses, spec_dst and iif are those of the packet that created
+ * it; with the restrictions above, the forwarding path only reads the
+ * gateway, device and metrics.
+ */
+static struct rtable *rt_nh_cache_lookup(struct fib_nh *nh)
+{
+	struct rtable *rth;
+
+	local_bh_disable();
+	rth = *this_cpu_ptr(nh->nh_pcpu_rth_input);
+	if (rth && !rt_is_expired(rth) &&
+	    !(rth->u.dst.expires &&
+	      time_after_eq(jiffies, rth->u.dst.expires)))
+		dst_use(&rth->u.dst, jiffies);
+	else
+		rth = NULL;
+	local_bh_enable();
+	return rth;
+}
+
+static void rt_nh_cache_store(struct fib_nh *nh, struct rtable *rth)
+{
+	struct rtable **p, *old;
+
+	dst_hold(&rth->u.dst);
+	local_bh_disable();
+	p = this_cpu_ptr(nh->nh_pcpu_rth_input);
+	old = *p;
+	*p = rth;
+	local_bh_enable();
+	if (old)
+		rt_drop(old);
+}
+
+/* Called from free_fib_info() once no lookup can reach the next hop. */
+void ip_rt_nh_cache_release(struct rtable * __percpu *cache)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct rtable *rth = *per_cpu_ptr(cache, cpu);
+
+		if (rth)
+			rt_drop(rth);
+	}
+}
+
 static int __mkroute_input(struct sk_buff *skb,
 			   struct fib_result *res,
 			   struct in_device *in_dev,
@@ -1991,6 +2067,7 @@ static int __mkroute_input(struct sk_buff *skb,
 	unsigned flags = 0;
 	__be32 spec_dst;
 	u32 itag;
+	bool do_cache;
 
 	/* get a working reference to the output device */
 	out_dev = in_dev_get(FIB_RES_DEV(*res));
@@ -2035,6 +2112,16 @@ static int __mkroute_input(struct sk_buff *skb,
 		}
 	}
 
+	do_cache = rt_nh_cacheable(skb, res, flags, itag);
+	if (do_cache) {
+		rth = rt_nh_cache_lookup(&FIB_RES_NH(*res));
+		if (rth) {
+			RT_CACHE_STAT_INC(in_hit);
+			skb_dst_set(skb, &rth->u.dst);
+			err = 0;
+			goto cleanup;
+		}
+	}
 
 	rth = dst_alloc(&ipv4_dst_ops);
 	if (!rth) {
@@ -2072,6 +2159,19 @@ static int __mkroute_input(struct sk_buff *skb,
 
 	rth->rt_flags = flags;
 
+	if (do_cache) {
+		/* only meaningful for the flow that created the entry */
+		rth->rt_flags &= ~RTCF_DIRECTSRC;
+		err = arp_bind_neighbour(&rth->u.dst);
+		if (err) {
+			rt_drop(rth);
+			goto cleanup;
+		}
+		rt_nh_cache_store(&FIB_RES_NH(*res), rth);
+		skb_dst_set(skb, &rth->u.dst);
+		goto cleanup;
+	}
+
 	*result = rth;
 	err = 0;
  cleanup:
@@ -2100,6 +2200,10 @@ static int ip_mkroute_input(struct sk_buff *skb,
 	if (err)
 		return err;
 
+	/* already attached from the next hop cache */
+	if (!rth)
+		return 0;
+
 	/* put it into the cache */
 	hash = rt_hash(daddr, saddr, fl->iif,
 		       rt_genid(dev_net(rth->u.dst.dev)));
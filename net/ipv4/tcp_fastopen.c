@@ -0,0 +1,99 @@
+/*
+ * TCP Fast Open (RFC 7413) cookie generation and client cookie cache.
+ *
+ * Server cookies are a keyed SHA-1 of the address pair, truncated to
+ * TCP_FASTOPEN_COOKIE_SIZE, computed the same way syncookies are.
+ * Clients remember the cookie (and the MSS) a server handed out in its
+ * inet_peer entry, so only IPv4 destinations are cached.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/spinlock.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+static u32 tcp_fastopen_secret[16 - 2] __read_mostly;
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+/* Serialises cookie updates in the inet_peer entries */
+static DEFINE_SPINLOCK(tcp_fastopen_cache_lock);
+
+/* Called from softirq context when a SYN is received. */
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 2, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	sha_init(tmp + 16);
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *foc)
+{
+	struct inet_peer *peer;
+
+	foc->len = -1;
+	if (sk->sk_family != AF_INET)
+		return;
+
+	foc->len = 0;
+	peer = inet_getpeer(inet_sk(sk)->inet_daddr, 0);
+	if (peer == NULL)
+		return;
+
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	if (peer->tcp_fastopen_mss)
+		*mss = peer->tcp_fastopen_mss;
+	if (peer->tcp_fastopen_len > 0) {
+		foc->len = peer->tcp_fastopen_len;
+		memcpy(foc->val, peer->tcp_fastopen_cookie, foc->len);
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+	inet_putpeer(peer);
+}
+
+/* Remember the MSS and any cookie the peer sent in its SYN-ACK. A
+ * SYN-ACK without a cookie keeps the one we already have.
+ */
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *foc)
+{
+	struct inet_peer *peer;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	peer = inet_getpeer(inet_sk(sk)->inet_daddr, 1);
+	if (peer == NULL)
+		return;
+
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (foc->len > 0) {
+		peer->tcp_fastopen_len = foc->len;
+		memcpy(peer->tcp_fastopen_cookie, foc->val, foc->len);
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+	inet_putpeer(peer);
+}
+
+void __init tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+}
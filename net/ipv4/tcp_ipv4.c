@@ -1218,10 +1218,68 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/* Accept a SYN carrying data and a valid Fast Open cookie: create the
+ * child right away, queue the data to it and put it on the accept queue.
+ * The child retransmits the SYN-ACK itself until the handshake completes
+ * (see tcp_retransmit_timer()). Returns 0 on success; on failure the
+ * caller falls back to a regular handshake, and dst has been released.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst,
+				    struct request_values *rvp)
+{
+	struct request_sock *acc_req;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	acc_req = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (acc_req == NULL) {
+		dst_release(dst);
+		return -1;
+	}
+
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (child == NULL) {
+		__reqsk_free(acc_req);
+		return -1;
+	}
+	tp = tcp_sk(child);
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	/* Queue the data carried in the SYN, and have the SYN-ACK ack it.
+	 * The skb keeps the SYN's sequence number, tcp_recvmsg() skips it.
+	 */
+	if (sk_rmem_schedule(child, skb->truesize)) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+		tp->rcv_nxt = tp->rcv_wup = TCP_SKB_CB(skb)->end_seq;
+		tcp_rsk(req)->rcv_nxt = tp->rcv_nxt;
+	}
+
+	req->retrans = 0;
+	tp->fastopen_rsk = req;
+	tcp_v4_send_synack(sk, NULL, req, rvp);
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, acc_req, child);
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1272,7 +1330,8 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0,
+			  tp->fastopen_listen ? &foc : NULL);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1309,6 +1368,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 		goto drop_and_release;
 	}
 	tmp_ext.cookie_in_always = tp->rx_opt.cookie_in_always;
+	tmp_ext.fastopen_cookie.len = -1;
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1380,6 +1440,24 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	if (!want_cookie && foc.len >= 0 &&
+	    (sysctl_tcp_fastopen & TFO_SERVER_ENABLE)) {
+		struct tcp_fastopen_cookie valid;
+
+		tcp_fastopen_cookie_gen(saddr, daddr, &valid);
+		if (foc.len != valid.len ||
+		    memcmp(foc.val, valid.val, valid.len)) {
+			/* Cookie request or stale cookie: hand out ours */
+			tmp_ext.fastopen_cookie = valid;
+		} else if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1 &&
+			   !tcp_hdr(skb)->fin && !sk_acceptq_is_full(sk)) {
+			if (!tcp_v4_conn_req_fastopen(sk, skb, req, dst,
+					(struct request_values *)&tmp_ext))
+				return 0;
+			dst = NULL;
+		}
+	}
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext) ||
 	    want_cookie)
@@ -1557,6 +1635,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 #endif
 
 	if (sk->sk_state == TCP_ESTABLISHED) { /* Fast path */
+		sock_rps_save_rxhash(sk, skb->rxhash);
 		TCP_CHECK_TIMER(sk);
 		if (tcp_rcv_established(sk, skb, tcp_hdr(skb), skb->len)) {
 			rsk = sk;
@@ -1575,6 +1654,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 			goto discard;
 
 		if (nsk != sk) {
+			sock_rps_save_rxhash(nsk, skb->rxhash);
 			if (tcp_child_process(sk, nsk, skb)) {
 				rsk = nsk;
 				goto reset;
@@ -1735,6 +1815,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1957,6 +2038,13 @@ void tcp_v4_destroy_sock(struct sock *sk)
 		tp->cookie_values = NULL;
 	}
 
+	/* TCP Fast Open */
+	tcp_free_fastopen_req(tp);
+	if (tp->fastopen_rsk != NULL) {
+		reqsk_free(tp->fastopen_rsk);
+		tp->fastopen_rsk = NULL;
+	}
+
 	percpu_counter_dec(&tcp_sockets_allocated);
 }
 
@@ -2516,6 +2604,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
@@ -95,6 +95,7 @@
 #include <linux/mm.h>
 #include <linux/inet.h>
 #include <linux/netdevice.h>
+#include <linux/percpu.h>
 #include <net/tcp_states.h>
 #include <linux/skbuff.h>
 #include <linux/proc_fs.h>
@@ -134,12 +135,15 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 {
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
+	int uid = sock_i_uid(sk);
 
 	sk_nulls_for_each(sk2, node, &hslot->head)
 		if (net_eq(sock_net(sk2), net) &&
 		    sk2 != sk &&
 		    (bitmap || udp_sk(sk2)->udp_port_hash == num) &&
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -165,6 +169,7 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 	struct sock *sk2;
 	struct hlist_nulls_node *node;
 	int res = 0;
+	int uid = sock_i_uid(sk);
 
 	spin_lock(&hslot2->lock);
 	udp_portaddr_for_each_entry(sk2, node, &hslot2->head)
@@ -172,6 +177,8 @@ static int udp_lib_lport_inuse2(struct net *net, __u16 num,
 		    sk2 != sk &&
 		    (udp_sk(sk2)->udp_port_hash == num) &&
 		    (!sk2->sk_reuse || !sk->sk_reuse) &&
+		    (!sk2->sk_reuseport || !sk->sk_reuseport ||
+		     uid != sock_i_uid(sk2)) &&
 		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if ||
 		     sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
 		    (*saddr_comp)(sk, sk2)) {
@@ -403,19 +410,32 @@ static struct sock *udp4_lib_lookup2(struct net *net,
 {
 	struct sock *sk, *result;
 	struct hlist_nulls_node *node;
-	int score, badness;
+	int score, badness, matches, reuseport;
+	u32 hash = 0;
 
 begin:
 	result = NULL;
 	badness = -1;
+	matches = 0;
+	reuseport = 0;
 	udp_portaddr_for_each_entry_rcu(sk, node, &hslot2->head) {
 		score = compute_score2(sk, net, saddr, sport,
 				      daddr, hnum, dif);
 		if (score > badness) {
 			result = sk;
 			badness = score;
-			if (score == SCORE2_MAX)
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			} else if (score == SCORE2_MAX)
 				goto exact_match;
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -451,7 +471,8 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	unsigned short hnum = ntohs(dport);
 	unsigned int hash2, slot2, slot = udp_hashfn(net, hnum, udptable->mask);
 	struct udp_hslot *hslot2, *hslot = &udptable->hash[slot];
-	int score, badness;
+	int score, badness, matches, reuseport;
+	u32 hash = 0;
 
 	rcu_read_lock();
 	if (hslot->count > 10) {
@@ -481,12 +502,25 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 begin:
 	result = NULL;
 	badness = -1;
+	matches = 0;
+	reuseport = 0;
 	sk_nulls_for_each_rcu(sk, node, &hslot->head) {
 		score = compute_score(sk, net, saddr, hnum, sport,
 				      daddr, dport, dif);
 		if (score > badness) {
 			result = sk;
 			badness = score;
+			reuseport = sk->sk_reuseport;
+			if (reuseport) {
+				hash = inet_ehashfn(net, daddr, hnum,
+						    saddr, sport);
+				matches = 1;
+			}
+		} else if (score == badness && reuseport) {
+			matches++;
+			if (((u64)hash * matches) >> 32 == 0)
+				result = sk;
+			hash = next_pseudo_random32(hash);
 		}
 	}
 	/*
@@ -1033,6 +1067,256 @@ out:
 }
 
 
+/*
+ *	Per-cpu receive queues (UDP_PERCPU_RXQ).
+ *
+ *	When several cpus deliver to the same socket, sock_queue_rcv_skb()
+ *	bounces the socket lock and sk_receive_queue.lock between them. With
+ *	UDP_PERCPU_RXQ set, softirq only touches atomic sk_rmem_alloc and a
+ *	queue private to the cpu it runs on; memory accounting against
+ *	udp_mem and the move onto sk_receive_queue are done by the reader,
+ *	one lock_sock() per batch.
+ */
+
+static void udp_rxq_rfree(struct sk_buff *skb)
+{
+	atomic_sub(skb->truesize, &skb->sk->sk_rmem_alloc);
+}
+
+int udp_rxq_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct sk_buff_head *rxq;
+	int skb_len;
+	int err;
+
+	if (atomic_read(&sk->sk_rmem_alloc) + skb->truesize >=
+	    (unsigned)sk->sk_rcvbuf) {
+		atomic_inc(&sk->sk_drops);
+		return -ENOMEM;
+	}
+
+	err = sk_filter(sk, skb);
+	if (err)
+		return err;
+
+	skb->dev = NULL;
+	skb_orphan(skb);
+	skb->sk = sk;
+	skb->destructor = udp_rxq_rfree;
+	atomic_add(skb->truesize, &sk->sk_rmem_alloc);
+	skb->dropcount = atomic_read(&sk->sk_drops);
+	skb_len = skb->len;
+
+	/* Pairs with the smp_wmb() in udp_rxq_enable() */
+	smp_rmb();
+	rxq = per_cpu_ptr(udp_sk(sk)->rxq, get_cpu());
+	skb_queue_tail(rxq, skb);
+	put_cpu();
+
+	if (!sock_flag(sk, SOCK_DEAD))
+		sk->sk_data_ready(sk, skb_len);
+	return 0;
+}
+EXPORT_SYMBOL(udp_rxq_queue_rcv_skb);
+
+static int udp_rxq_empty(struct sock *sk)
+{
+	struct sk_buff_head __percpu *rxq = udp_sk(sk)->rxq;
+	int cpu;
+
+	if (rxq == NULL)
+		return 1;
+
+	for_each_possible_cpu(cpu)
+		if (!skb_queue_empty(per_cpu_ptr(rxq, cpu)))
+			return 0;
+	return 1;
+}
+
+/*
+ *	Move everything queued on the per-cpu queues to sk_receive_queue,
+ *	charging it to the socket. Returns the number of datagrams moved.
+ */
+static int udp_rxq_drain(struct sock *sk)
+{
+	struct sk_buff_head __percpu *rxq = udp_sk(sk)->rxq;
+	struct sk_buff_head list, list_kill;
+	struct sk_buff *skb, *tmp;
+	unsigned long flags;
+	int cpu, n;
+
+	if (rxq == NULL)
+		return 0;
+
+	__skb_queue_head_init(&list);
+	for_each_possible_cpu(cpu) {
+		struct sk_buff_head *q = per_cpu_ptr(rxq, cpu);
+
+		if (skb_queue_empty(q))
+			continue;
+		spin_lock_bh(&q->lock);
+		skb_queue_splice_tail_init(q, &list);
+		spin_unlock_bh(&q->lock);
+	}
+	if (skb_queue_empty(&list))
+		return 0;
+
+	__skb_queue_head_init(&list_kill);
+
+	lock_sock(sk);
+	skb_queue_walk_safe(&list, skb, tmp) {
+		if (!sk_rmem_schedule(sk, skb->truesize)) {
+			__skb_unlink(skb, &list);
+			__skb_queue_tail(&list_kill, skb);
+			continue;
+		}
+		sk_mem_charge(sk, skb->truesize);
+		skb->destructor = sock_rfree;
+	}
+	n = skb_queue_len(&list);
+
+	spin_lock_irqsave(&sk->sk_receive_queue.lock, flags);
+	skb_queue_splice_tail(&list, &sk->sk_receive_queue);
+	spin_unlock_irqrestore(&sk->sk_receive_queue.lock, flags);
+	release_sock(sk);
+
+	if (!skb_queue_empty(&list_kill)) {
+		int is_udplite = IS_UDPLITE(sk);
+
+		while ((skb = __skb_dequeue(&list_kill)) != NULL) {
+			atomic_inc(&sk->sk_drops);
+			UDP_INC_STATS_USER(sock_net(sk),
+					   UDP_MIB_RCVBUFERRORS, is_udplite);
+			UDP_INC_STATS_USER(sock_net(sk),
+					   UDP_MIB_INERRORS, is_udplite);
+			kfree_skb(skb);
+		}
+	}
+	return n;
+}
+
+static void udp_rxq_destruct(struct sock *sk)
+{
+	struct sk_buff_head __percpu *rxq = udp_sk(sk)->rxq;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		skb_queue_purge(per_cpu_ptr(rxq, cpu));
+	free_percpu(rxq);
+	udp_sk(sk)->rxq = NULL;
+
+	sk->sk_destruct = udp_sk(sk)->rxq_old_destruct;
+	if (sk->sk_destruct != NULL)
+		(*sk->sk_destruct)(sk);
+}
+
+/*
+ *	The queues are only freed with the socket, so the bh receive path
+ *	never sees them go away under it. The destructor that was installed
+ *	before ours (inet, inet6 or an encapsulation owner) is chained to.
+ */
+static int udp_rxq_enable(struct sock *sk, int val)
+{
+	struct udp_sock *up = udp_sk(sk);
+	int cpu;
+
+	lock_sock(sk);
+	if (val && up->rxq == NULL) {
+		struct sk_buff_head __percpu *rxq;
+
+		rxq = alloc_percpu(struct sk_buff_head);
+		if (rxq == NULL) {
+			release_sock(sk);
+			return -ENOMEM;
+		}
+		for_each_possible_cpu(cpu)
+			skb_queue_head_init(per_cpu_ptr(rxq, cpu));
+		smp_wmb();
+		up->rxq = rxq;
+		up->rxq_old_destruct = sk->sk_destruct;
+		sk->sk_destruct = udp_rxq_destruct;
+		smp_wmb();
+	}
+	up->percpu_rxq = val ? 1 : 0;
+	release_sock(sk);
+	return 0;
+}
+
+/*
+ *	Same wait as in net/core/datagram.c, but also woken for datagrams
+ *	still sitting on the per-cpu queues.
+ */
+static int udp_rxq_wait(struct sock *sk, int *err, long *timeo_p)
+{
+	int error;
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait_exclusive(sk->sk_sleep, &wait, TASK_INTERRUPTIBLE);
+
+	/* Socket errors? */
+	error = sock_error(sk);
+	if (error)
+		goto out_err;
+
+	if (!skb_queue_empty(&sk->sk_receive_queue) || !udp_rxq_empty(sk))
+		goto out;
+
+	/* Socket shut down? */
+	if (sk->sk_shutdown & RCV_SHUTDOWN)
+		goto out_noerr;
+
+	/* handle signals */
+	if (signal_pending(current))
+		goto interrupted;
+
+	error = 0;
+	*timeo_p = schedule_timeout(*timeo_p);
+out:
+	finish_wait(sk->sk_sleep, &wait);
+	return error;
+interrupted:
+	error = sock_intr_errno(*timeo_p);
+out_err:
+	*err = error;
+	goto out;
+out_noerr:
+	*err = 0;
+	error = 1;
+	goto out;
+}
+
+/**
+ *	udp_recv_datagram - receive a datagram from a UDP socket
+ *	@sk: socket
+ *	@flags: MSG_ flags
+ *	@peeked: returns non-zero if this packet has been seen before
+ *	@err: error code returned
+ *
+ *	__skb_recv_datagram() that first pulls in whatever the per-cpu
+ *	receive queues hold, if the socket has them.
+ */
+struct sk_buff *udp_recv_datagram(struct sock *sk, unsigned flags,
+				  int *peeked, int *err)
+{
+	struct sk_buff *skb;
+	long timeo;
+
+	if (udp_sk(sk)->rxq == NULL)
+		return __skb_recv_datagram(sk, flags, peeked, err);
+
+	timeo = sock_rcvtimeo(sk, flags & MSG_DONTWAIT);
+	do {
+		udp_rxq_drain(sk);
+		skb = __skb_recv_datagram(sk, flags | MSG_DONTWAIT,
+					  peeked, err);
+		if (skb != NULL || *err != -EAGAIN || !timeo)
+			return skb;
+	} while (!udp_rxq_wait(sk, err, &timeo));
+
+	return NULL;
+}
+EXPORT_SYMBOL(udp_recv_datagram);
+
 /**
  *	first_packet_length	- return length of first packet in receive queue
  *	@sk: socket
@@ -1048,6 +1332,8 @@ static unsigned int first_packet_length(struct sock *sk)
 
 	__skb_queue_head_init(&list_kill);
 
+	udp_rxq_drain(sk);
+
 	spin_lock_bh(&rcvq->lock);
 	while ((skb = skb_peek(rcvq)) != NULL &&
 		udp_lib_checksum_complete(skb)) {
@@ -1131,9 +1417,11 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	if (flags & MSG_ERRQUEUE)
 		return ip_recv_error(sk, msg, len);
 
+	sock_rps_record_flow(sk);
+
 try_again:
-	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
-				  &peeked, &err);
+	skb = udp_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
+				&peeked, &err);
 	if (!skb)
 		goto out;
 
@@ -1257,7 +1545,16 @@ EXPORT_SYMBOL(udp_lib_unhash);
 
 static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
-	int rc = sock_queue_rcv_skb(sk, skb);
+	int rc;
+
+	/* Only connected sockets see a single flow worth steering */
+	if (inet_sk(sk)->inet_daddr)
+		sock_rps_save_rxhash(sk, skb->rxhash);
+
+	if (udp_sk(sk)->percpu_rxq)
+		rc = udp_rxq_queue_rcv_skb(sk, skb);
+	else
+		rc = sock_queue_rcv_skb(sk, skb);
 
 	if (rc < 0) {
 		int is_udplite = IS_UDPLITE(sk);
@@ -1366,6 +1663,10 @@ int udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 			goto drop;
 	}
 
+	/* Per-cpu queueing needs neither the socket lock nor the backlog */
+	if (up->percpu_rxq)
+		return __udp_queue_rcv_skb(sk, skb);
+
 	rc = 0;
 
 	bh_lock_sock(sk);
@@ -1649,6 +1950,10 @@ int udp_lib_setsockopt(struct sock *sk, int level, int optname,
 		}
 		break;
 
+	case UDP_PERCPU_RXQ:
+		err = udp_rxq_enable(sk, val);
+		break;
+
 	case UDP_ENCAP:
 		switch (val) {
 		case 0:
@@ -1743,6 +2048,10 @@ int udp_lib_getsockopt(struct sock *sk, int level, int optname,
 		val = up->corkflag;
 		break;
 
+	case UDP_PERCPU_RXQ:
+		val = up->percpu_rxq;
+		break;
+
 	case UDP_ENCAP:
 		val = up->encap_type;
 		break;
@@ -1804,6 +2113,10 @@ unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	unsigned int mask = datagram_poll(file, sock, wait);
 	struct sock *sk = sock->sk;
 
+	/* datagram_poll() only looks at sk_receive_queue */
+	if (udp_rxq_drain(sk))
+		mask |= POLLIN | POLLRDNORM;
+
 	/* Check for false positives due to checksum errors */
 	if ((mask & POLLRDNORM) && !(file->f_flags & O_NONBLOCK) &&
 	    !(sk->sk_shutdown & RCV_SHUTDOWN) && !first_packet_length(sk))
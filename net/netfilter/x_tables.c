@@ -661,6 +661,7 @@ void xt_free_table_info(struct xt_table_info *info)
 		else
 			vfree(info->entries[cpu]);
 	}
+	vfree(info->classifier);
 	kfree(info);
 }
 EXPORT_SYMBOL(xt_free_table_info);
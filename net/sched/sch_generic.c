@@ -37,16 +37,74 @@
  * - updates to tree and tree walking are only done under the rtnl mutex.
  */
 
+/*
+ * Upper bound on the bytes pulled off a TCQ_F_ONETXQUEUE qdisc in one
+ * qdisc lock hold and handed to the driver back to back, for drivers
+ * that do not maintain a byte queue limit.
+ */
+#define QDISC_BULK_BYTES	(16 * 1024)
+
+/*
+ * A BQL aware driver tells us how many more bytes its ring should take;
+ * anything bulked beyond that would only sit in the ring, or be
+ * requeued once the queue is stopped.
+ */
+static inline int qdisc_avail_bulklimit(const struct netdev_queue *txq)
+{
+#ifdef CONFIG_BQL
+	if (txq->dql.num_queued)
+		return dql_avail(&txq->dql);
+#endif
+	return QDISC_BULK_BYTES;
+}
+
+/*
+ * An skb parked in q->gso_skb is either a single GSO skb, whose ->next
+ * list holds the segments not yet sent, or a bulk dequeued chain of
+ * skbs linked through ->next.  try_bulk_dequeue_skb() ends a chain at
+ * the first GSO skb, so the two never mix.
+ */
+static inline struct sk_buff *skb_chain_next(struct sk_buff *skb)
+{
+	return skb_is_gso(skb) ? NULL : skb->next;
+}
+
+static inline unsigned int skb_chain_len(struct sk_buff *skb)
+{
+	unsigned int len = 0;
+
+	for (; skb; skb = skb_chain_next(skb))
+		len++;
+	return len;
+}
+
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	q->gso_skb = skb;
 	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	q->q.qlen += skb_chain_len(skb);	/* it's still part of the queue */
 	__netif_schedule(q);
 
 	return 0;
 }
 
+static void try_bulk_dequeue_skb(struct Qdisc *q, struct sk_buff *skb,
+				 const struct netdev_queue *txq)
+{
+	int bytelimit = qdisc_avail_bulklimit(txq) - skb->len;
+	struct sk_buff *nskb;
+
+	while (bytelimit > 0 && !skb_is_gso(skb)) {
+		nskb = q->dequeue(q);
+		if (!nskb)
+			break;
+
+		bytelimit -= nskb->len;
+		skb->next = nskb;
+		skb = nskb;
+	}
+}
+
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
@@ -57,19 +115,32 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-		if (!netif_tx_queue_stopped(txq) &&
-		    !netif_tx_queue_frozen(txq)) {
+		if (!netif_xmit_frozen_or_stopped(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			q->q.qlen -= skb_chain_len(skb);
 		} else
 			skb = NULL;
 	} else {
 		skb = q->dequeue(q);
+		if (skb && (q->flags & TCQ_F_ONETXQUEUE))
+			try_bulk_dequeue_skb(q, skb,
+				netdev_get_tx_queue(qdisc_dev(q),
+						    skb_get_queue_mapping(skb)));
 	}
 
 	return skb;
 }
 
+static void kfree_skb_chain(struct sk_buff *skb)
+{
+	struct sk_buff *next;
+
+	for (; skb; skb = next) {
+		next = skb_chain_next(skb);
+		kfree_skb(skb);
+	}
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
@@ -83,7 +154,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		 * detect it by checking xmit owner and drop the packet when
 		 * deadloop is detected. Return OK to try the next skb.
 		 */
-		kfree_skb(skb);
+		kfree_skb_chain(skb);
 		if (net_ratelimit())
 			printk(KERN_WARNING "Dead loop on netdevice %s, "
 			       "fix it urgently!\n", dev_queue->dev->name);
@@ -101,9 +172,46 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 }
 
 /*
- * Transmit one skb, and handle the return status as required. Holding the
- * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
- * function.
+ * Hand a chain of skbs to the driver back to back, setting xmit_more on
+ * all but the last (and the one before a software GSO tail) so that it
+ * can defer the doorbell to the end of the batch.  Returns the part of
+ * the chain that was not consumed, or NULL.
+ */
+static struct sk_buff *dev_xmit_skb_chain(struct sk_buff *skb,
+					  struct net_device *dev,
+					  struct netdev_queue *txq, int *ret)
+{
+	while (skb) {
+		struct sk_buff *next = skb_chain_next(skb);
+
+		if (next)
+			skb->next = NULL;
+		/* A GSO skb that fails software segmentation is freed by
+		 * dev_hard_start_xmit() without the driver seeing it, so
+		 * the doorbell must not be deferred to one. */
+		skb->xmit_more = next && !netif_needs_gso(dev, next);
+
+		*ret = dev_hard_start_xmit(skb, dev, txq);
+		if (!dev_xmit_complete(*ret)) {
+			if (next)
+				skb->next = next;
+			return skb;
+		}
+
+		skb = next;
+		if (skb && netif_xmit_frozen_or_stopped(txq)) {
+			*ret = NETDEV_TX_BUSY;
+			return skb;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Transmit one skb, or a bulk dequeued chain of them, and handle the
+ * return status as required. Holding the __QDISC_STATE_RUNNING bit
+ * guarantees that only one CPU can execute this function.
  *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
@@ -119,14 +227,14 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 	spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) && !netif_tx_queue_frozen(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
+	if (!netif_xmit_frozen_or_stopped(txq))
+		skb = dev_xmit_skb_chain(skb, dev, txq, &ret);
 
 	HARD_TX_UNLOCK(dev, txq);
 
 	spin_lock(root_lock);
 
-	if (dev_xmit_complete(ret)) {
+	if (!skb) {
 		/* Driver sent out skb successfully or skb was consumed */
 		ret = qdisc_qlen(q);
 	} else if (ret == NETDEV_TX_LOCKED) {
@@ -141,8 +249,7 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		ret = dev_requeue_skb(skb, q);
 	}
 
-	if (ret && (netif_tx_queue_stopped(txq) ||
-		    netif_tx_queue_frozen(txq)))
+	if (ret && netif_xmit_frozen_or_stopped(txq))
 		ret = 0;
 
 	return ret;
@@ -583,7 +690,7 @@ void qdisc_reset(struct Qdisc *qdisc)
 		ops->reset(qdisc);
 
 	if (qdisc->gso_skb) {
-		kfree_skb(qdisc->gso_skb);
+		kfree_skb_chain(qdisc->gso_skb);
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
@@ -612,7 +719,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	module_put(ops->owner);
 	dev_put(qdisc_dev(qdisc));
 
-	kfree_skb(qdisc->gso_skb);
+	kfree_skb_chain(qdisc->gso_skb);
 	kfree((char *) qdisc - qdisc->padded);
 }
 EXPORT_SYMBOL(qdisc_destroy);
@@ -657,7 +764,7 @@ static void attach_one_default_qdisc(struct net_device *dev,
 		}
 
 		/* Can by-pass the queue discipline for default qdisc */
-		qdisc->flags |= TCQ_F_CAN_BYPASS;
+		qdisc->flags |= TCQ_F_CAN_BYPASS | TCQ_F_ONETXQUEUE;
 	} else {
 		qdisc =  &noqueue_qdisc;
 	}
@@ -60,7 +60,7 @@ static int mq_init(struct Qdisc *sch, struct nlattr *opt)
 						    TC_H_MIN(ntx + 1)));
 		if (qdisc == NULL)
 			goto err;
-		qdisc->flags |= TCQ_F_CAN_BYPASS;
+		qdisc->flags |= TCQ_F_CAN_BYPASS | TCQ_F_ONETXQUEUE;
 		priv->qdiscs[ntx] = qdisc;
 	}
 
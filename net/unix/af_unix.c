@@ -112,6 +112,8 @@
 #include <linux/poll.h>
 #include <linux/rtnetlink.h>
 #include <linux/mount.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 #include <net/checksum.h>
 #include <linux/security.h>
 
@@ -167,6 +169,14 @@ static inline int unix_may_send(struct sock *sk, struct sock *osk)
 	return unix_peer(osk) == NULL || unix_our_peer(sk, osk);
 }
 
+/* Stream readers consume an skb in place rather than pulling it, as it
+ * may carry page fragments from unix_stream_sendpage().
+ */
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 static inline int unix_recvq_full(struct sock const *sk)
 {
 	return skb_queue_len(&sk->sk_receive_queue) > sk->sk_max_ack_backlog;
@@ -349,6 +359,12 @@ static void unix_sock_destructor(struct sock *sk)
 
 	skb_queue_purge(&sk->sk_receive_queue);
 
+	/* Left over from splicing linear data out of the receive queue */
+	if (sk->sk_sndmsg_page) {
+		__free_page(sk->sk_sndmsg_page);
+		sk->sk_sndmsg_page = NULL;
+	}
+
 	WARN_ON(atomic_read(&sk->sk_wmem_alloc));
 	WARN_ON(!sk_unhashed(sk));
 	WARN_ON(sk->sk_socket);
@@ -503,6 +519,11 @@ static int unix_dgram_connect(struct socket *, struct sockaddr *,
 			      int, int);
 static int unix_seqpacket_sendmsg(struct kiocb *, struct socket *,
 				  struct msghdr *, size_t);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *, int offset,
+				    size_t size, int flags);
+static ssize_t unix_stream_splice_read(struct socket *,  loff_t *ppos,
+				       struct pipe_inode_info *, size_t size,
+				       unsigned int flags);
 
 static const struct proto_ops unix_stream_ops = {
 	.family =	PF_UNIX,
@@ -522,7 +543,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1493,6 +1515,26 @@ out:
 }
 
 
+/* Queue a stream skb to the peer. Only the peer's receive queue lock is
+ * taken: unix_release_sock() marks the socket dead before it flushes the
+ * queue under that lock, so a buffer is either refused here or flushed
+ * there, and senders do not contend with the reader on unix_state_lock.
+ */
+static int unix_stream_queue_skb(struct sock *other, struct sk_buff *skb)
+{
+	struct sk_buff_head *queue = &other->sk_receive_queue;
+
+	spin_lock(&queue->lock);
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN)) {
+		spin_unlock(&queue->lock);
+		return -EPIPE;
+	}
+	__skb_queue_tail(queue, skb);
+	spin_unlock(&queue->lock);
+	return 0;
+}
+
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
 {
@@ -1582,14 +1624,8 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			goto out_err;
 		}
 
-		unix_state_lock(other);
-
-		if (sock_flag(other, SOCK_DEAD) ||
-		    (other->sk_shutdown & RCV_SHUTDOWN))
+		if (unix_stream_queue_skb(other, skb))
 			goto pipe_err_free;
-
-		skb_queue_tail(&other->sk_receive_queue, skb);
-		unix_state_unlock(other);
 		other->sk_data_ready(other, size);
 		sent += size;
 	}
@@ -1600,7 +1636,6 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	return sent;
 
 pipe_err_free:
-	unix_state_unlock(other);
 	kfree_skb(skb);
 pipe_err:
 	if (sent == 0 && !(msg->msg_flags&MSG_NOSIGNAL))
@@ -1612,6 +1647,59 @@ out_err:
 	return sent ? : err;
 }
 
+/* Attach the page itself to an skb for the peer instead of copying it,
+ * so splice() from a pipe moves data to the reader by reference.
+ */
+static ssize_t unix_stream_sendpage(struct socket *sock, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct sock *other;
+	struct sk_buff *skb;
+	struct scm_cookie scm;
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	skb = sock_alloc_send_skb(sk, 0, flags & MSG_DONTWAIT, &err);
+	if (skb == NULL)
+		return err;
+
+	UNIXCREDS(skb)->pid = task_tgid_vnr(current);
+	UNIXCREDS(skb)->uid = current_uid();
+	UNIXCREDS(skb)->gid = current_gid();
+	/* Same label scm_send() would give the sendmsg path */
+	unix_get_peersec_dgram(sock, &scm);
+	unix_get_secdata(&scm, skb);
+
+	get_page(page);
+	skb_fill_page_desc(skb, 0, page, offset, size);
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	if (unix_stream_queue_skb(other, skb)) {
+		kfree_skb(skb);
+		goto pipe_err;
+	}
+	other->sk_data_ready(other, size);
+	return size;
+
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+	return -EPIPE;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1857,8 +1945,9 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		if (skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+					    msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1869,13 +1958,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(siocb->scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len) {
+			if (unix_skb_len(skb)) {
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
 			}
@@ -1902,6 +1991,111 @@ out:
 	return copied ? : err;
 }
 
+/* The reader holds u->readlock across splice_to_pipe(), which takes the
+ * pipe lock. That is safe because the writer side (sendmsg and sendpage,
+ * including splice from a pipe) never takes the peer's readlock.
+ */
+static ssize_t unix_splice_to_pipe(struct sock *sk,
+				   struct pipe_inode_info *pipe,
+				   struct splice_pipe_desc *spd)
+{
+	return splice_to_pipe(pipe, spd);
+}
+
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t size, unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	struct unix_sock *u = unix_sk(sk);
+	struct scm_cookie scm;
+	ssize_t spliced = 0;
+	long timeo;
+	int err;
+
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -EINVAL;
+
+	timeo = sock_rcvtimeo(sk, (sock->file->f_flags & O_NONBLOCK) ||
+				  (flags & SPLICE_F_NONBLOCK));
+
+	/* Descriptors cannot go through a pipe; like a read that does not
+	 * ask for them, the ones we pass over are dropped.
+	 */
+	memset(&scm, 0, sizeof(scm));
+
+	mutex_lock(&u->readlock);
+
+	while (size) {
+		struct sk_buff *skb;
+		int chunk, ret;
+
+		unix_state_lock(sk);
+		skb = skb_dequeue(&sk->sk_receive_queue);
+		if (skb == NULL) {
+			err = 0;
+			if (spliced)
+				goto unlock;
+			err = sock_error(sk);
+			if (err)
+				goto unlock;
+			if (sk->sk_shutdown & RCV_SHUTDOWN)
+				goto unlock;
+
+			unix_state_unlock(sk);
+			err = -EAGAIN;
+			if (!timeo)
+				break;
+			mutex_unlock(&u->readlock);
+
+			timeo = unix_stream_data_wait(sk, timeo);
+
+			if (signal_pending(current)) {
+				err = sock_intr_errno(timeo);
+				goto out;
+			}
+			mutex_lock(&u->readlock);
+			continue;
+ unlock:
+			unix_state_unlock(sk);
+			break;
+		}
+		unix_state_unlock(sk);
+
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		ret = skb_splice_bits(skb, sk, UNIXCB(skb).consumed, pipe,
+				      chunk, flags, unix_splice_to_pipe);
+		if (ret <= 0) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			err = ret ? : -ENOMEM;
+			break;
+		}
+		spliced += ret;
+		size -= ret;
+
+		UNIXCB(skb).consumed += ret;
+		if (UNIXCB(skb).fp)
+			unix_detach_fds(&scm, skb);
+
+		if (unix_skb_len(skb)) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			break;
+		}
+		kfree_skb(skb);
+
+		if (scm.fp)
+			break;
+	}
+
+	mutex_unlock(&u->readlock);
+	scm_destroy(&scm);
+out:
+	return spliced ? : err;
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -1968,7 +2162,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
@@ -1170,6 +1170,7 @@ static struct xfrm_state *xfrm_state_clone(struct xfrm_state *orig, int *errp)
 	}
 
 	memcpy(&x->mark, &orig->mark, sizeof(x->mark));
+	x->props.extra_flags = orig->props.extra_flags;
 
 	err = xfrm_init_state(x);
 	if (err)
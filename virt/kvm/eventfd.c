@@ -33,6 +33,7 @@
 
 #include "iodev.h"
 
+#ifdef CONFIG_HAVE_KVM_IRQCHIP
 /*
  * --------------------------------------------------------------------
  * irqfd: Allows an fd to be used to inject an interrupt to the guest
@@ -243,6 +244,7 @@ fail:
 	kfree(irqfd);
 	return ret;
 }
+#endif /* CONFIG_HAVE_KVM_IRQCHIP */
 
 void
 kvm_eventfd_init(struct kvm *kvm)
@@ -252,6 +254,7 @@ kvm_eventfd_init(struct kvm *kvm)
 	INIT_LIST_HEAD(&kvm->ioeventfds);
 }
 
+#ifdef CONFIG_HAVE_KVM_IRQCHIP
 /*
  * shutdown any irqfd's that match fd+gsi
  */
@@ -339,6 +342,7 @@ static void __exit irqfd_module_exit(void)
 
 module_init(irqfd_module_init);
 module_exit(irqfd_module_exit);
+#endif /* CONFIG_HAVE_KVM_IRQCHIP */
 
 /*
  * --------------------------------------------------------------------